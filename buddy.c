@@ -0,0 +1,379 @@
+/*
+ * buddy.c - Binary buddy allocator, an alternative engine to mm.c on the
+ * same memlib heap.
+ *
+ * Every block is 2^k bytes (MIN_ORDER <= k < MAX_ORDER) and starts at a
+ * multiple of 2^k from the heap base, so the buddy of a block is found by
+ * flipping bit k of its offset. A block starts with a double-word header: the
+ * first word holds the order and a free bit, the second is used by memalign
+ * (below). Free blocks of order k are on the doubly linked list free_lists[k],
+ * with the links right after the header.
+ * Allocation rounds the request plus header up to a power of two and splits a
+ * bigger free block in halves until it has one of that order. Freeing merges
+ * the block with its buddy for as long as the buddy is free and of the same
+ * order. There is no footer and no size search, at the price of internal
+ * fragmentation of up to half a block.
+ * The heap grows in whole blocks. To get a block of order k the top of the
+ * heap is first padded to a multiple of 2^k with the largest aligned blocks
+ * that fit, which become free blocks of their own.
+ * A memalign'd payload is moved up inside its block; a copy of the header just
+ * before the payload keeps the order and, in the second word, how far the header
+ * is from the start of the block.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "buddy.h"
+#include "memlib.h"
+
+
+/* Basic constants and macros */
+#define WSIZE 4
+#define DSIZE 8
+#define MIN_ORDER 5     /* smallest block: header plus two list links */
+#define MAX_ORDER 31    /* blocks are smaller than 2^MAX_ORDER bytes */
+
+#define BLOCK(k) ((size_t)1 << (k))
+#define PACK(order, free) (((order) << 1) | (free))
+
+#define GET(p) (*(unsigned int *)(p))
+#define PUT(p, val) (*(unsigned int *)(p) = (unsigned int)(val))
+
+#define GET_ORDER(p) (GET(p) >> 1)
+#define GET_FREE(p) (GET(p) & 0x1)
+#define GET_SHIFT(p) (GET((char *)(p) + WSIZE))
+
+/* Header of a payload, and the block that header belongs to */
+#define HDRP(bp) ((char *)(bp) - DSIZE)
+#define BLKP(hp) ((char *)(hp) - GET_SHIFT(hp))
+
+/* Next and previous free block of the same order */
+#define NEXT(b) (*(char **)((char *)(b) + DSIZE))
+#define PREV(b) (*(char **)((char *)(b) + DSIZE + sizeof(char *)))
+
+/* Offset of block b from the heap base */
+#define OFFSET(b) ((size_t)((char *)(b) - heap_base))
+
+int buddy_check(void);
+
+
+/* global variable */
+static char *heap_base;
+static char *free_lists[MAX_ORDER];
+
+/* helper functions */
+static int order_of(size_t bytes);
+static char *take(int k);
+static int grow(int k);
+static void release(char *b, int k);
+static void push(char *b, int k);
+static void unlink_block(char *b, int k);
+static char *heap_end(void);
+
+
+/*
+ * buddy_check - Check the free lists and the block headers they point to.
+ */
+int buddy_check(void)
+{
+    char *b;
+    char *buddy;
+    int k;
+
+    for (k = 0; k < MAX_ORDER; k++) {
+        for (b = free_lists[k]; b != NULL; b = NEXT(b)) {
+            /* 1. Check whether every free block is marked free with its list's order */
+            if (!GET_FREE(b) || GET_ORDER(b) != k) {
+                printf("Error: %p - Free block with a wrong header \n", b);
+                assert(0);
+            }
+            /* 2. Check whether every free block is aligned to its size and inside the heap */
+            if (k < MIN_ORDER || (OFFSET(b) & (BLOCK(k) - 1)) != 0 || b + BLOCK(k) > heap_end()) {
+                printf("Error: %p - Misplaced free block \n", b);
+                assert(0);
+            }
+            /* 3. Check whether the list links are consistent */
+            if (NEXT(b) != NULL && PREV(NEXT(b)) != b) {
+                printf("Error: %p - Broken free list link \n", b);
+                assert(0);
+            }
+            /* 4. Check whether every free block is merged with a free buddy */
+            buddy = heap_base + (OFFSET(b) ^ BLOCK(k));
+            if (buddy + BLOCK(k) <= heap_end() && GET_FREE(buddy) && GET_ORDER(buddy) == k) {
+                printf("Error: %p - Not merged free buddies \n", b);
+                assert(0);
+            }
+        }
+    }
+    return 1;
+}
+
+/* Helper function implementation */
+
+/*
+ * order_of - Return the order of the smallest block that holds bytes bytes,
+ * or -1 if no block is that big.
+ */
+static int order_of(size_t bytes) {
+    int k = MIN_ORDER;
+
+    while (k < MAX_ORDER && BLOCK(k) < bytes)
+        k++;
+    return k < MAX_ORDER ? k : -1;
+}
+
+/*
+ * take - Remove a free block of order k from the lists, splitting the smallest
+ * bigger one or growing the heap if there is none. Returns NULL if out of memory.
+ */
+static char *take(int k) {
+    char *b;
+    int j;
+
+    for (j = k; j < MAX_ORDER && free_lists[j] == NULL; j++)
+        ;
+    if (j == MAX_ORDER) {
+        if (grow(k) < 0)
+            return NULL;
+        for (j = k; free_lists[j] == NULL; j++)
+            ;
+    }
+    b = free_lists[j];
+    unlink_block(b, j);
+
+    /* Split off upper halves until the block has order k */
+    while (j > k) {
+        j--;
+        push(b + BLOCK(j), j);
+    }
+    return b;
+}
+
+/*
+ * grow - Extend the heap by a block of order k, padding the top of the heap up
+ * to a multiple of 2^k with free blocks first. Returns -1 if out of memory.
+ */
+static int grow(int k) {
+    size_t off;
+    char *b;
+    int j;
+
+    for (;;) {
+        /* The largest block that can start at the top of the heap, up to order k */
+        off = OFFSET(heap_end());
+        for (j = MIN_ORDER; j < k && (off & BLOCK(j)) == 0; j++)
+            ;
+        if ((b = mem_sbrk(BLOCK(j))) == (void *)-1)
+            return -1;
+        release(b, j);
+        if (j == k)
+            return 0;
+    }
+}
+
+/*
+ * release - Merge free block b of order k with its free buddies and put the result
+ * on its list.
+ */
+static void release(char *b, int k) {
+    char *buddy;
+    char *end = heap_end();
+
+    while (k + 1 < MAX_ORDER) {
+        buddy = heap_base + (OFFSET(b) ^ BLOCK(k));
+        if (buddy + BLOCK(k) > end || !GET_FREE(buddy) || GET_ORDER(buddy) != k)
+            break;
+        unlink_block(buddy, k);
+        if (buddy < b)
+            b = buddy;
+        k++;
+    }
+    push(b, k);
+}
+
+/*
+ * push - Mark b as a free block of order k and put it at the front of its list.
+ */
+static void push(char *b, int k) {
+    PUT(b, PACK(k, 1));
+    PUT(b + WSIZE, 0);
+    NEXT(b) = free_lists[k];
+    PREV(b) = NULL;
+    if (free_lists[k] != NULL)
+        PREV(free_lists[k]) = b;
+    free_lists[k] = b;
+}
+
+/*
+ * unlink_block - Take free block b off the list of order k.
+ */
+static void unlink_block(char *b, int k) {
+    if (PREV(b) != NULL)
+        NEXT(PREV(b)) = NEXT(b);
+    else
+        free_lists[k] = NEXT(b);
+    if (NEXT(b) != NULL)
+        PREV(NEXT(b)) = PREV(b);
+}
+
+/*
+ * heap_end - Return the first address past the heap.
+ */
+static char *heap_end(void) {
+    return (char *)mem_heap_hi() + 1;
+}
+/* End of helper function implementation */
+
+/*
+ * buddy_init - initialize the buddy allocator on an empty heap.
+ */
+int buddy_init(void)
+{
+    memset(free_lists, 0, sizeof(free_lists));
+    heap_base = mem_sbrk(0);
+    if (heap_base == (void *)-1)
+        return -1;
+    return 0;
+}
+
+/*
+ * buddy_malloc - Allocate the smallest block that holds the header and size bytes.
+ */
+void *buddy_malloc(size_t size)
+{
+    char *b;
+    int k;
+
+    if (size == 0 || (k = order_of(size + DSIZE)) < 0)
+        return NULL;
+    if ((b = take(k)) == NULL)
+        return NULL;
+    PUT(b, PACK(k, 0));
+    PUT(b + WSIZE, 0);
+    return b + DSIZE;
+}
+
+/*
+ * buddy_calloc - Allocate a block for nmemb elements of size bytes and zero it.
+ */
+void *buddy_calloc(size_t nmemb, size_t size)
+{
+    void *bp;
+
+    if (nmemb == 0 || size == 0)
+        return NULL;
+    if (nmemb > (size_t)-1 / size) /* nmemb*size overflows */
+        return NULL;
+    if ((bp = buddy_malloc(nmemb * size)) != NULL)
+        memset(bp, 0, nmemb * size);
+    return bp;
+}
+
+/*
+ * buddy_memalign - Allocate size bytes whose address is a multiple of align
+ * (a power of two). The block is big enough to move the payload up to the
+ * next aligned address; the header is copied to just below the payload.
+ */
+void *buddy_memalign(size_t align, size_t size)
+{
+    char *b;
+    char *bp;
+    int k;
+
+    if (align <= DSIZE)
+        return buddy_malloc(size);
+    if ((align & (align - 1)) != 0)
+        return NULL;
+    if (size == 0 || size > (size_t)-1 - align || (k = order_of(size + align)) < 0)
+        return NULL;
+    if ((b = take(k)) == NULL)
+        return NULL;
+    bp = (char *)(((size_t)b + DSIZE + align - 1) & ~(align - 1));
+    PUT(b, PACK(k, 0));
+    PUT(b + WSIZE, 0);
+    PUT(HDRP(bp), PACK(k, 0));
+    PUT(HDRP(bp) + WSIZE, HDRP(bp) - b);
+    return bp;
+}
+
+/*
+ * buddy_free - Free the block of ptr and merge it with its buddies.
+ */
+void buddy_free(void *ptr)
+{
+    if (ptr == NULL)
+        return;
+    release(BLKP(HDRP(ptr)), GET_ORDER(HDRP(ptr)));
+}
+
+/*
+ * buddy_free_sized - Free a block the caller knows was allocated with size bytes.
+ * The order in the header is all the buddy allocator needs, so size is only checked.
+ */
+void buddy_free_sized(void *ptr, size_t size)
+{
+    assert(size <= buddy_usable_size(ptr));
+    buddy_free(ptr);
+}
+
+/*
+ * buddy_usable_size - Return the bytes from ptr to the end of its block.
+ */
+size_t buddy_usable_size(void *ptr)
+{
+    if (ptr == NULL)
+        return 0;
+    return BLKP(HDRP(ptr)) + BLOCK(GET_ORDER(HDRP(ptr))) - (char *)ptr;
+}
+
+/*
+ * buddy_realloc - If ptr is NULL, it equals to buddy_malloc; if size is 0, to buddy_free.
+ * A block that still holds size bytes is kept. A block that is the lower half of its
+ * buddy pair grows in place while the upper buddies are free and of the same order.
+ * Otherwise the payload is copied to a new block.
+ */
+void *buddy_realloc(void *ptr, size_t size)
+{
+    char *b;
+    char *bp;
+    char *buddy;
+    size_t need;
+    int k, j;
+
+    if (ptr == NULL)
+        return buddy_malloc(size);
+    if (size == 0) {
+        buddy_free(ptr);
+        return NULL;
+    }
+    if (size <= buddy_usable_size(ptr))
+        return ptr;
+
+    /* Grow in place if the blocks above are free buddies of the right orders */
+    b = BLKP(HDRP(ptr));
+    k = GET_ORDER(HDRP(ptr));
+    need = size + ((char *)ptr - b);
+    for (j = k; j < MAX_ORDER - 1 && BLOCK(j) < need; j++) {
+        buddy = b + BLOCK(j);
+        if ((OFFSET(b) & BLOCK(j)) != 0 || buddy + BLOCK(j) > heap_end() ||
+            !GET_FREE(buddy) || GET_ORDER(buddy) != j)
+            break;
+    }
+    if (BLOCK(j) >= need) {
+        for (; k < j; k++)
+            unlink_block(b + BLOCK(k), k);
+        PUT(b, PACK(j, 0));
+        if ((char *)ptr != b + DSIZE)
+            PUT(HDRP(ptr), PACK(j, 0));
+        return ptr;
+    }
+
+    if ((bp = buddy_malloc(size)) == NULL)
+        return NULL;
+    memcpy(bp, ptr, buddy_usable_size(ptr));
+    buddy_free(ptr);
+    return bp;
+}
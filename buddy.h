@@ -0,0 +1,15 @@
+#include <stdio.h>
+
+/*
+ * Binary buddy allocator: an alternative engine with the same interface as
+ * mm.c, also built on memlib. mdriver replays traces on it with -e buddy.
+ */
+extern int buddy_init (void);
+extern void *buddy_malloc (size_t size);
+extern void *buddy_calloc (size_t nmemb, size_t size);
+extern void *buddy_memalign (size_t align, size_t size);
+extern void buddy_free (void *ptr);
+extern void buddy_free_sized (void *ptr, size_t size);
+extern size_t buddy_usable_size (void *ptr);
+extern void *buddy_realloc(void *ptr, size_t size);
+extern int buddy_check(void);
@@ -62,6 +62,12 @@
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 
+/* 
+ * Fixed address of a file-backed heap (mem_init_file), so that the
+ * pointers stored in a saved heap are still valid when it is mapped again
+ */
+#define MEM_FILE_BASE 0x40000000
+
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
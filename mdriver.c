@@ -15,11 +15,16 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <malloc.h>
+#include <sched.h>
+#include <pthread.h>
 
 #include "mm.h"
+#include "buddy.h"
 #include "memlib.h"
 #include "fsecs.h"
 #include "config.h"
+#include "trace.h"
 
 /**********************
  * Constants and macros
@@ -29,39 +34,27 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define BATCHMAX      64 /* max ops replayed by one batch call (-b) */
+#define MT_HOT        16 /* blocks each thread keeps writing to (-m) */
+#define RANGE_CHUNK 1024 /* range records taken from libc at a time */
+#define THINK_MAX 1000000 /* max ns of trace think time replayed by -B */
 
-/* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+/* Returns true if p is a-byte aligned (a is a power of two) */
+#define IS_ALIGNED(p, a)  ((((unsigned int)(p)) & ((a) - 1)) == 0)
 
 /****************************** 
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* Records the extent of each block's payload, as a node of an AVL tree */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *left;  /* payloads below lo */
+    struct range_t *right; /* payloads above lo; next record in the pool */
+    int height;            /* height of the subtree */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
-
-/* Holds the information for one trace file*/
-typedef struct {
-    int sugg_heapsize;   /* suggested heap size (unused) */
-    int num_ids;         /* number of alloc/realloc ids */
-    int num_ops;         /* number of distinct requests */
-    int weight;          /* weight for this trace (unused) */
-    traceop_t *ops;      /* array of requests */
-    char **blocks;       /* array of ptrs returned by malloc/realloc... */
-    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
-} trace_t;
-
 /* 
  * Holds the params to the xxx_speed functions, which are timed by fcyc. 
  * This struct is necessary because fcyc accepts only a pointer array
@@ -72,15 +65,74 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* Holds the params to the snapshot_xxx functions, which are timed by fsecs */
+typedef struct {
+    trace_t *trace;
+    int prefix;                /* ops replayed before the snapshot */
+    char heap_path[MAXLINE];   /* file backing the snapshot heap */
+    char meta_path[MAXLINE];   /* file written by mm_checkpoint */
+} snapshot_t;
+
+/* Holds the state of one thread of the eval_mm_scaling and eval_mm_threads benchmarks */
+typedef struct {
+    pthread_t tid;
+    trace_t *trace;
+    int *ops;            /* indexes of the ops this thread replays, NULL for all... */
+    int num_ops;         /* ... and how many */
+    char **blocks;       /* payload of each id: this thread's own, or shared */
+    volatile unsigned *done; /* ops done on each shared id, NULL if not shared */
+    unsigned *nth;       /* how many ops on its id come before each op */
+    volatile int *stop;  /* set when any thread fails */
+    pthread_barrier_t *start;
+    int hot;             /* keep writing to its last MT_HOT blocks (-m, copies only) */
+    double begin, end;   /* secs on the monotonic clock at the barrier and the last op */
+    int failed;          /* set if mm ran out of heap */
+} scale_thread_t;
+
+/* Throughput of one eval_mm_scaling run, in Kops/s */
+typedef struct {
+    double total;          /* all ops over the wall time, 0 if the heap ran out */
+    double min, avg, max;  /* each busy thread's ops over its own time */
+} scale_t;
+
+/* An allocator engine the driver can replay traces on (-e) */
+typedef struct {
+    char *name;
+    int (*init)(void);
+    void *(*malloc)(size_t size);
+    void *(*calloc)(size_t nmemb, size_t size);
+    void *(*memalign)(size_t align, size_t size);
+    void (*free_sized)(void *ptr, size_t size);
+    size_t (*usable_size)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+} engine_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
     double ops;      /* number of ops (malloc/free/realloc) in the trace */
     int valid;       /* was the trace processed correctly by the allocator? */
     double secs;     /* number of secs needed to run the trace */
+    double load_secs; /* secs to read the trace file */
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    double util_low; /* utilization with low-end placement (set by -p) */
+    double util_oracle; /* utilization of the best oracle split (-o)... */
+    int oracle_split;   /* ... and the lifetime (in ops) splitting short from long */
+    double frag;     /* internal fragmentation at the peak payload */
+    double region_secs; /* secs to run the trace with regions (set by -r) */
+    int compactions;    /* compaction passes run on the trace (set by -c)... */
+    double heap_before; /* ... and the total heap size before them ... */
+    double heap_after;  /* ... and after them */
+    double p50[2];      /* median op latency in ns without/with the thread (-B)... */
+    double p99[2];      /* ... and 99th percentile */
+    double snap_replay_secs;  /* secs to replay the snapshot prefix (-S)... */
+    double snap_restore_secs; /* ... and to restore the snapshot instead */
+    double mt_kops[2];  /* Kops/s on mm_threads threads, packed/lines (-m) */
+    double check_secs[4]; /* secs to run the trace with checking off, tier 0, 1, 2 (-k) */
+    scale_t *scale;     /* throughput on 1..scale_threads threads (-T)... */
+    int scale_split;    /* ... split by the thread column, or else copies */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
@@ -92,6 +144,50 @@ int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
+/* Unused range records, linked through their right pointers */
+static range_t *range_pool = NULL;
+
+/* Batched replay (-b): runs of same-size allocs and of frees */
+static int batch = 0;                 /* replay through the mm batch calls? */
+static void *batch_allocs[BATCHMAX];  /* blocks from the last mm_malloc_batch... */
+static int batch_nalloc, batch_next;  /* ... how many, and the next one to hand out */
+static void *batch_frees[BATCHMAX];   /* frees deferred until the run ends */
+static int batch_nfree;
+
+/* The engines, and the one being evaluated (-e) */
+static engine_t engines[] = {
+    {"mm", mm_init, mm_malloc, mm_calloc, mm_memalign, mm_free_sized,
+     mm_usable_size, mm_realloc},
+    {"buddy", buddy_init, buddy_malloc, buddy_calloc, buddy_memalign,
+     buddy_free_sized, buddy_usable_size, buddy_realloc},
+};
+#define NUM_ENGINES ((int)(sizeof(engines) / sizeof(engines[0])))
+static engine_t *engine = &engines[0];
+
+/* Region replay (-r): ids [k*region_ids, (k+1)*region_ids) share region k */
+static int region_ids = 0;
+
+/* Oracle replay (-o): lifetime class of each op, passed to mm_malloc_hint */
+static int *life_hints = NULL;
+
+/* Latency replay (-B): per-op latencies in ns, one slot per op */
+static double *latencies = NULL;
+
+/* Compacting replay (-c): handle blocks, compacted every compact_ops ops */
+static int compact_ops = 0;
+
+/* Snapshot replay (-S): checkpoint after the first snapshot_ops ops */
+static int snapshot_ops = 0;
+
+/* Multithreaded replay (-m): the number of threads */
+static int mm_threads = 0;
+
+/* Scaling replay (-T): time replay on 1..scale_threads threads */
+static int scale_threads = 0;
+
+/* mm checking tier (-k): 0, 1 or 2, -1 = off */
+static int check_tier = -1;
+
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
@@ -105,15 +201,22 @@ static char *default_tracefiles[] = {
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
-static int add_range(range_t **ranges, char *lo, int size, 
+/* these functions manipulate range sets */
+static int add_range(range_t **ranges, char *lo, int size, int align,
 		     int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static range_t *range_new(void);
+static void range_free(range_t *p);
+static int range_height(range_t *p);
+static range_t *range_balance(range_t *p);
+static void range_fix(range_t *p);
+static range_t *range_insert(range_t *root, range_t *p);
+static range_t *range_delete(range_t *root, char *lo);
 
 /* These functions read, allocate, and free storage for traces */
-static trace_t *read_trace(char *tracedir, char *filename);
-static void free_trace(trace_t *trace);
+static trace_t *load_trace(char *tracedir, char *filename, double *secs);
+static void check_size(traceop_t *op, uint64_t opnum, char *path);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
@@ -122,11 +225,70 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   double *frag);
 static void eval_mm_speed(void *ptr);
 
+/* Routines for evaluating the mm package's regions on the same traces */
+static int eval_mm_region_valid(trace_t *trace, int tracenum, 
+				range_t **ranges);
+static void eval_mm_region_speed(void *ptr);
+static char *region_op(trace_t *trace, int opnum, mm_region_t **regions, 
+		       int *live);
+
+/* Routine for replaying a trace on mm as it streams in from disk */
+static void eval_mm_stream(char *path);
+
+/* Routine for timing mm at each checking tier */
+static void eval_mm_checks(speed_t *speed_params, stats_t *stats);
+
+/* Routine for evaluating mm with hints from the trace's actual lifetimes */
+static double eval_mm_oracle(trace_t *trace, int tracenum, range_t **ranges,
+			     int *split);
+
+/* Routine for timing each op, with or without the mm maintenance thread */
+static void eval_mm_latency(trace_t *trace, int background, 
+			    double *p50, double *p99);
+static void think(uint64_t ns);
+static int double_cmp(const void *a, const void *b);
+
+/* Routines for snapshotting mm after a trace prefix and restoring it */
+static int eval_mm_snapshot(trace_t *trace, int tracenum, stats_t *stats);
+static void snapshot_replay(void *ptr);
+static void snapshot_restore(void *ptr);
+static int replay_ops(trace_t *trace, int tracenum, int from, int to);
+
+/* Routines for replaying a trace on several threads at once */
+static double eval_mm_threads(trace_t *trace, int line);
+
+/* Routines for timing replay on 1..scale_threads threads, with a barrier start */
+static void eval_mm_scaling(trace_t *trace, stats_t *stats);
+static int scale_run(trace_t *trace, int n, int split, unsigned *nth, int hot,
+		     scale_t *scale);
+static void *scale_replay(void *ptr);
+
+/* Routines for replaying a trace with mm handles and compaction */
+static int eval_mm_compact(trace_t *trace, int tracenum, stats_t *stats);
+static int compact_pass(trace_t *trace, int tracenum, int opnum,
+			mm_handle_t **handles, stats_t *stats);
+
+/* These functions replay allocs and frees, in batches if -b is given */
+static void batch_reset(void);
+static void *batch_malloc(trace_t *trace, int opnum);
+static void batch_free(trace_t *trace, int opnum, void *p);
+static void free_op(traceop_t *op, void *p);
+
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printplacement(int n, stats_t *stats, size_t split);
+static void printregions(int n, stats_t *stats);
+static void printcompaction(int n, stats_t *stats);
+static void printlatency(int n, stats_t *stats);
+static void printoracle(int n, stats_t *stats);
+static void printsnapshot(int n, stats_t *stats);
+static void printthreads(int n, stats_t *stats);
+static void printscaling(int n, stats_t *stats);
+static void printchecks(int n, stats_t *stats);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -149,6 +311,11 @@ int main(int argc, char **argv)
 
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int cmp_place = 0;   /* If set, compare placement policies (-p) */
+    int cmp_latency = 0; /* If set, compare latency with the mm thread (-B) */
+    int cmp_oracle = 0;  /* If set, compare util with oracle lifetime hints (-o) */
+    long place_split = -1; /* placement split threshold (-s), -1 = mm default */
+    char *stream_path = NULL; /* trace to stream through mm (-F) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -157,7 +324,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgl")) != EOF) {
+    while ((c = getopt(argc, argv, "f:F:t:s:r:e:c:S:m:T:k:bBhvVglpo")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -170,6 +337,9 @@ int main(int argc, char **argv)
             tracefiles[0] = strdup(optarg);
             tracefiles[1] = NULL;
             break;
+        case 'F': /* Stream one big trace file through mm, nothing else */
+            stream_path = optarg;
+            break;
 	case 't': /* Directory where the traces are located */
 	    if (num_tracefiles == 1) /* ignore if -f already encountered */
 		break;
@@ -177,9 +347,64 @@ int main(int argc, char **argv)
 	    if (tracedir[strlen(tracedir)-1] != '/') 
 		strcat(tracedir, "/"); /* path always ends with "/" */
 	    break;
+        case 'e': /* Replay on the named engine instead of mm */
+            for (i = 0; i < NUM_ENGINES; i++)
+                if (strcmp(optarg, engines[i].name) == 0)
+                    break;
+            if (i == NUM_ENGINES)
+                app_error("-e requires mm or buddy");
+            engine = &engines[i];
+            break;
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'b': /* Replay runs of allocs and frees through the batch calls */
+            batch = 1;
+            break;
+        case 'B': /* Compare op latency without and with the mm thread */
+            cmp_latency = 1;
+            break;
+        case 'o': /* Compare utilization with oracle lifetime hints */
+            cmp_oracle = 1;
+            break;
+        case 'p': /* Compare low-end and size-segregated placement */
+            cmp_place = 1;
+            break;
+        case 'r': /* Group every <n> ids into a region */
+            region_ids = atoi(optarg);
+            if (region_ids <= 0)
+                app_error("-r requires a positive number of ids");
+            break;
+        case 'c': /* Replay with handles, compacting every <n> ops */
+            compact_ops = atoi(optarg);
+            if (compact_ops <= 0)
+                app_error("-c requires a positive number of ops");
+            break;
+        case 'S': /* Snapshot after <n> ops, time restore against replay */
+            snapshot_ops = atoi(optarg);
+            if (snapshot_ops <= 0)
+                app_error("-S requires a positive number of ops");
+            break;
+        case 'm': /* Replay on <n> threads, packed and cache-line blocks */
+            mm_threads = atoi(optarg);
+            if (mm_threads <= 0)
+                app_error("-m requires a positive number of threads");
+            break;
+        case 'T': /* Time replay on 1..<n> threads */
+            scale_threads = atoi(optarg);
+            if (scale_threads <= 0)
+                app_error("-T requires a positive number of threads");
+            break;
+        case 'k': /* Run mm with heap checking of tier <n> */
+            check_tier = atoi(optarg);
+            if (check_tier < 0 || check_tier > 2)
+                app_error("-k requires a check tier of 0, 1 or 2");
+            break;
+        case 's': /* Size threshold for size-segregated placement */
+            place_split = atol(optarg);
+            if (place_split < 0)
+                app_error("-s requires a non-negative size");
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -195,6 +420,21 @@ int main(int argc, char **argv)
         }
     }
 	
+    if (engine != &engines[0] && (batch || cmp_place || cmp_latency || cmp_oracle ||
+				  region_ids || compact_ops || snapshot_ops || 
+				  mm_threads || scale_threads || check_tier >= 0 ||
+				  place_split >= 0))
+	app_error("-b, -B, -c, -k, -m, -o, -p, -r, -S, -s and -T require the mm engine");
+
+    /* A streamed trace is replayed on its own */
+    if (stream_path != NULL) {
+	if (engine != &engines[0])
+	    app_error("-F requires the mm engine");
+	mem_init();
+	eval_mm_stream(stream_path);
+	exit(0);
+    }
+
     /* 
      * If no -f command line arg, then use the entire set of tracefiles 
      * defined in default_traces[]
@@ -222,7 +462,9 @@ int main(int argc, char **argv)
 	
 	/* Evaluate the libc malloc package using the K-best scheme */
 	for (i=0; i < num_tracefiles; i++) {
-	    trace = read_trace(tracedir, tracefiles[i]);
+	    if (verbose > 1)
+		printf("Reading tracefile: %s\n", tracefiles[i]);
+	    trace = load_trace(tracedir, tracefiles[i], &libc_stats[i].load_secs);
 	    libc_stats[i].ops = trace->num_ops;
 	    if (verbose > 1)
 		printf("Checking libc malloc for correctness, ");
@@ -247,7 +489,7 @@ int main(int argc, char **argv)
      * Always run and evaluate the student's mm package
      */
     if (verbose > 1)
-	printf("\nTesting mm malloc\n");
+	printf("\nTesting %s malloc\n", engine->name);
 
     /* Allocate the mm stats array, with one stats_t struct per tracefile */
     mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
@@ -256,33 +498,127 @@ int main(int argc, char **argv)
     
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
+    if (place_split >= 0)
+	mm_setopt(MM_OPT_PLACE_SPLIT, place_split);
+    else
+	place_split = MM_PLACE_SPLIT_DEFAULT;
+    if (check_tier >= 0)
+	mm_setopt(MM_OPT_CHECK, MM_CHECK_LOCAL + check_tier);
 
     /* Evaluate student's mm malloc package using the K-best scheme */
     for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
+	if (verbose > 1)
+	    printf("Reading tracefile: %s\n", tracefiles[i]);
+	trace = load_trace(tracedir, tracefiles[i], &mm_stats[i].load_secs);
 	mm_stats[i].ops = trace->num_ops;
 	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
+	    printf("Checking %s_malloc for correctness, ", engine->name);
 	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
 	if (mm_stats[i].valid) {
 	    if (verbose > 1)
 		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
+	    mm_stats[i].util = eval_mm_util(trace, i, &ranges, 
+					    &mm_stats[i].frag);
+	    if (cmp_place) {
+		mm_setopt(MM_OPT_PLACE_SPLIT, 0);
+		mm_stats[i].util_low = eval_mm_util(trace, i, &ranges, NULL);
+		mm_setopt(MM_OPT_PLACE_SPLIT, place_split);
+	    }
+	    if (cmp_oracle)
+		mm_stats[i].util_oracle = eval_mm_oracle(trace, i, &ranges, 
+							 &mm_stats[i].oracle_split);
 	    speed_params.trace = trace;
 	    speed_params.ranges = ranges;
 	    if (verbose > 1)
 		printf("and performance.\n");
 	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    if (check_tier >= 0) {
+		if (verbose > 1)
+		    printf("Timing mm at each check tier up to %d.\n", check_tier);
+		eval_mm_checks(&speed_params, &mm_stats[i]);
+	    }
+	    if (region_ids) {
+		if (verbose > 1)
+		    printf("Checking mm regions for correctness and performance.\n");
+		if (eval_mm_region_valid(trace, i, &ranges))
+		    mm_stats[i].region_secs = 
+			fsecs(eval_mm_region_speed, &speed_params);
+	    }
+	    if (cmp_latency) {
+		if (verbose > 1)
+		    printf("Timing each op without and with the mm thread.\n");
+		eval_mm_latency(trace, 0, &mm_stats[i].p50[0], &mm_stats[i].p99[0]);
+		eval_mm_latency(trace, 1, &mm_stats[i].p50[1], &mm_stats[i].p99[1]);
+	    }
+	    if (mm_threads) {
+		if (verbose > 1)
+		    printf("Timing replay on %d threads with packed and cache-line blocks.\n",
+			   mm_threads);
+		mm_stats[i].mt_kops[0] = eval_mm_threads(trace, 0);
+		mm_stats[i].mt_kops[1] = eval_mm_threads(trace, 1);
+	    }
+	    if (scale_threads) {
+		if (verbose > 1)
+		    printf("Timing replay on 1 to %d threads.\n", scale_threads);
+		eval_mm_scaling(trace, &mm_stats[i]);
+	    }
+	    if (snapshot_ops) {
+		if (verbose > 1)
+		    printf("Timing mm restore against replay of the first %d ops.\n",
+			   snapshot_ops);
+		eval_mm_snapshot(trace, i, &mm_stats[i]);
+	    }
+	    if (compact_ops) {
+		if (verbose > 1)
+		    printf("Checking mm handles and compaction for correctness.\n");
+		eval_mm_compact(trace, i, &mm_stats[i]);
+	    }
 	}
 	free_trace(trace);
     }
 
     /* Display the mm results in a compact table */
     if (verbose) {
-	printf("\nResults for mm malloc:\n");
+	printf("\nResults for %s malloc:\n", engine->name);
 	printresults(num_tracefiles, mm_stats);
 	printf("\n");
     }
+    if (cmp_place) {
+	printplacement(num_tracefiles, mm_stats, place_split);
+	printf("\n");
+    }
+    if (region_ids) {
+	printregions(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (compact_ops) {
+	printcompaction(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (cmp_latency) {
+	printlatency(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (cmp_oracle) {
+	printoracle(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (snapshot_ops) {
+	printsnapshot(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (mm_threads) {
+	printthreads(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (scale_threads) {
+	printscaling(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (check_tier >= 0) {
+	printchecks(num_tracefiles, mm_stats);
+	printf("\n");
+    }
 
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
@@ -337,30 +673,38 @@ int main(int argc, char **argv)
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range set, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range set to detect any overlapping allocated blocks. It is an AVL
+ * tree ordered by lo, so a new payload only has to be checked against
+ * the payloads just below and above it. Range records come from
+ * chunks of RANGE_CHUNK records that are reused across traces.
  ****************************************************************/
 
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
- *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     size bytes at addr lo, which must be align-byte aligned. After 
+ *     checking the block for correctness, we create a range struct for 
+ *     this block and add it to the range set. 
  */
-static int add_range(range_t **ranges, char *lo, int size, 
+static int add_range(range_t **ranges, char *lo, int size, int align,
 		     int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
     range_t *p;
+    range_t *below = NULL; /* payload with the greatest lo <= lo */
+    range_t *above = NULL; /* payload with the least lo > lo */
     char msg[MAXLINE];
 
     assert(size > 0);
 
-    /* Payload addresses must be ALIGNMENT-byte aligned */
-    if (!IS_ALIGNED(lo)) {
+    /* Payload addresses must be ALIGNMENT-byte aligned, or more if asked */
+    if (align < ALIGNMENT)
+	align = ALIGNMENT;
+    if (!IS_ALIGNED(lo, align)) {
 	sprintf(msg, "Payload address (%p) not aligned to %d bytes", 
-		lo, ALIGNMENT);
+		lo, align);
         malloc_error(tracenum, opnum, msg);
         return 0;
     }
@@ -374,27 +718,37 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    /* The payload must not overlap its neighbours, hence any other payload */
+    for (p = *ranges;  p != NULL; ) {
+	if (p->lo <= lo) {
+	    below = p;
+	    p = p->right;
+	} else {
+	    above = p;
+	    p = p->left;
+	}
+    }
+    if ((p = below) != NULL && p->hi >= lo)
+	above = NULL;
+    else if ((p = above) != NULL && p->lo <= hi)
+	below = NULL;
+    else
+	p = NULL;
+    if (p != NULL) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range set.
      */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-	unix_error("malloc error in add_range");
-    p->next = *ranges;
+    p = range_new();
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    *ranges = range_insert(*ranges, p);
     return 1;
 }
 
@@ -402,138 +756,272 @@ static int add_range(range_t **ranges, char *lo, int size,
  * remove_range - Free the range record of block whose payload starts at lo 
  */
 static void remove_range(range_t **ranges, char *lo)
+{
+    *ranges = range_delete(*ranges, lo);
+}
+
+/*
+ * clear_ranges - free all of the range records for a trace 
+ */
+static void clear_ranges(range_t **ranges)
+{
+    range_t *p = *ranges;
+
+    if (p == NULL)
+	return;
+    clear_ranges(&p->left);
+    clear_ranges(&p->right);
+    range_free(p);
+    *ranges = NULL;
+}
+
+/*
+ * range_new - Take a range record from the pool, refilling it from
+ *     libc RANGE_CHUNK records at a time
+ */
+static range_t *range_new(void)
 {
     range_t *p;
-    range_t **prevpp = ranges;
-    int size;
+    int i;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    if (range_pool == NULL) {
+	if ((p = (range_t *)malloc(RANGE_CHUNK * sizeof(range_t))) == NULL)
+	    unix_error("malloc error in range_new");
+	for (i = 0; i < RANGE_CHUNK; i++)
+	    range_free(&p[i]);
     }
+    p = range_pool;
+    range_pool = p->right;
+    p->left = p->right = NULL;
+    p->height = 1;
+    return p;
 }
 
 /*
- * clear_ranges - free all of the range records for a trace 
+ * range_free - Give a range record back to the pool
  */
-static void clear_ranges(range_t **ranges)
+static void range_free(range_t *p)
+{
+    p->right = range_pool;
+    range_pool = p;
+}
+
+/* The height of a range subtree, 0 if empty */
+static int range_height(range_t *p)
+{
+    return p == NULL ? 0 : p->height;
+}
+
+/*
+ * range_balance - Recompute the height of p, whose subtrees are AVL trees
+ *     of heights that differ by 2 at most, and rotate it back into balance.
+ *     Returns the new root of the subtree.
+ */
+static range_t *range_balance(range_t *p)
+{
+    range_t *q;
+    int diff = range_height(p->left) - range_height(p->right);
+
+    if (diff > 1) {
+	if (range_height(p->left->left) < range_height(p->left->right)) {
+	    q = p->left->right;     /* rotate p->left left first */
+	    p->left->right = q->left;
+	    q->left = p->left;
+	    p->left = q;
+	    range_fix(q->left);
+	}
+	q = p->left;                /* rotate p right */
+	p->left = q->right;
+	q->right = p;
+	range_fix(p);
+	p = q;
+    } else if (diff < -1) {
+	if (range_height(p->right->right) < range_height(p->right->left)) {
+	    q = p->right->left;     /* rotate p->right right first */
+	    p->right->left = q->right;
+	    q->right = p->right;
+	    p->right = q;
+	    range_fix(q->right);
+	}
+	q = p->right;               /* rotate p left */
+	p->right = q->left;
+	q->left = p;
+	range_fix(p);
+	p = q;
+    }
+    range_fix(p);
+    return p;
+}
+
+/* Recompute the height of p from its subtrees */
+static void range_fix(range_t *p)
+{
+    int l = range_height(p->left);
+    int r = range_height(p->right);
+
+    p->height = (l > r ? l : r) + 1;
+}
+
+/*
+ * range_insert - Add record p to the subtree at root; returns the new root
+ */
+static range_t *range_insert(range_t *root, range_t *p)
+{
+    if (root == NULL)
+	return p;
+    if (p->lo < root->lo)
+	root->left = range_insert(root->left, p);
+    else
+	root->right = range_insert(root->right, p);
+    return range_balance(root);
+}
+
+/*
+ * range_delete - Remove and free the record of the payload at lo from the
+ *     subtree at root, if it is there; returns the new root
+ */
+static range_t *range_delete(range_t *root, char *lo)
 {
     range_t *p;
-    range_t *pnext;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
+    if (root == NULL)
+	return NULL;
+    if (lo < root->lo)
+	root->left = range_delete(root->left, lo);
+    else if (lo > root->lo)
+	root->right = range_delete(root->right, lo);
+    else {
+	if (root->left == NULL || root->right == NULL) {
+	    p = root->left != NULL ? root->left : root->right;
+	    range_free(root);
+	    return p;
+	}
+	/* Replace root with the least record of its right subtree */
+	for (p = root->right; p->left != NULL; p = p->left)
+	    ;
+	root->lo = p->lo;
+	root->hi = p->hi;
+	root->right = range_delete(root->right, p->lo);
     }
-    *ranges = NULL;
+    return range_balance(root);
 }
 
 
-/**********************************************
- * The following routines manipulate tracefiles
- *********************************************/
+/*****************************************************************
+ * The following routine reads a trace for the eval functions; the
+ * parsing and mapping themselves are in trace.c.
+ ****************************************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * load_trace - read a trace file and set secs to the time it took
  */
-static trace_t *read_trace(char *tracedir, char *filename)
+static trace_t *load_trace(char *tracedir, char *filename, double *secs)
 {
-    FILE *tracefile;
+    struct timespec start, end;
     trace_t *trace;
-    char type[MAXLINE];
-    char path[MAXLINE];
-    unsigned index, size;
-    unsigned max_index = 0;
-    unsigned op_index;
+    int i;
 
-    if (verbose > 1)
-	printf("Reading tracefile: %s\n", filename);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    trace = read_trace(tracedir, filename);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    for (i = 0; i < trace->num_ops; i++)
+	check_size(&trace->ops[i], i, filename);
+    return trace;
+}
 
-    /* Allocate the trace record */
-    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
-	unix_error("malloc 1 failed in read_trance");
-	
-    /* Read the trace file header */
-    strcpy(path, tracedir);
-    strcat(path, filename);
-    if ((tracefile = fopen(path, "r")) == NULL) {
-	sprintf(msg, "Could not open %s in read_trace", path);
-	unix_error(msg);
-    }
-    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
-    fscanf(tracefile, "%d", &(trace->num_ids));     
-    fscanf(tracefile, "%d", &(trace->num_ops));     
-    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
-    
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops = 
-	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-	unix_error("malloc 2 failed in read_trace");
-
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks = 
-	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
-	unix_error("malloc 3 failed in read_trace");
-
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes = 
-	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
-	unix_error("malloc 4 failed in read_trace");
-    
-    /* read every request line in the trace file */
-    index = 0;
-    op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-	switch(type[0]) {
-	case 'a':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = ALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'r':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = REALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'f':
-	    fscanf(tracefile, "%ud", &index);
-	    trace->ops[op_index].type = FREE;
-	    trace->ops[op_index].index = index;
-	    break;
-	default:
-	    printf("Bogus type character (%c) in tracefile %s\n", 
-		   type[0], path);
-	    exit(1);
+/*
+ * check_size - exit if request opnum of the trace at path asks for more
+ *    than MAX_HEAP bytes. Trace sizes are 64 bits, and mm and the replays
+ *    take a size_t or an int, so a bigger one would be truncated.
+ */
+static void check_size(traceop_t *op, uint64_t opnum, char *path)
+{
+    if (op->type != FREE && op->size > MAX_HEAP) {
+	sprintf(msg, "Request %llu of %s asks for %llu bytes, more than MAX_HEAP",
+		(unsigned long long)opnum, path, (unsigned long long)op->size);
+	app_error(msg);
+    }
+}
+
+
+/*****************************************************************
+ * The following routines replay allocs and frees for the eval_mm
+ * functions. With -b, a run of consecutive allocs of one size is
+ * allocated by a single mm_malloc_batch call when the run starts, and
+ * a run of consecutive frees is handed to mm_free_batch when it ends.
+ ****************************************************************/
+
+/*
+ * batch_reset - forget any batch state left over from an earlier replay
+ */
+static void batch_reset(void)
+{
+    batch_nalloc = batch_next = 0;
+    batch_nfree = 0;
+}
+
+/*
+ * batch_malloc - mm_malloc for the ALLOC request opnum
+ */
+static void *batch_malloc(trace_t *trace, int opnum)
+{
+    int size = trace->ops[opnum].size;
+    int n;
+
+    if (life_hints != NULL)
+	return mm_malloc_hint(size, life_hints[opnum]);
+    if (!batch)
+	return engine->malloc(size);
+
+    /* Start of a run: allocate every block of it at once */
+    if (batch_next == batch_nalloc) {
+	for (n = 1; n < BATCHMAX && opnum + n < trace->num_ops; n++) {
+	    if (trace->ops[opnum + n].type != ALLOC || 
+		trace->ops[opnum + n].size != size)
+		break;
 	}
-	op_index++;
-	
+	batch_nalloc = mm_malloc_batch(size, n, batch_allocs);
+	batch_next = 0;
+	if (batch_nalloc == 0)
+	    return NULL;
+    }
+    return batch_allocs[batch_next++];
+}
+
+/*
+ * batch_free - mm_free for the FREE request opnum, passing the size the
+ *     trace gives for a sized free, or else the size the block was
+ *     allocated with (trace->block_sizes must be up to date)
+ */
+static void batch_free(trace_t *trace, int opnum, void *p)
+{
+    traceop_t *op = &trace->ops[opnum];
+
+    if (!batch) {
+	engine->free_sized(p, op->size != 0 ? op->size : trace->block_sizes[op->index]);
+	return;
+    }
+
+    /* Defer the free until the run of frees ends */
+    batch_frees[batch_nfree++] = p;
+    if (batch_nfree == BATCHMAX || opnum + 1 == trace->num_ops ||
+	trace->ops[opnum + 1].type != FREE) {
+	mm_free_batch(batch_frees, batch_nfree);
+	batch_nfree = 0;
     }
-    fclose(tracefile);
-    assert(max_index == trace->num_ids - 1);
-    assert(trace->num_ops == op_index);
-    
-    return trace;
 }
 
 /*
- * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ * free_op - mm_free for the FREE request op, or mm_free_sized if the
+ *     trace gives its size
  */
-void free_trace(trace_t *trace)
+static void free_op(traceop_t *op, void *p)
 {
-    free(trace->ops);         /* free the three arrays... */
-    free(trace->blocks);      
-    free(trace->block_sizes);
-    free(trace);              /* and the trace record itself... */
+    if (op->size != 0)
+	mm_free_sized(p, op->size);
+    else
+	mm_free(p);
 }
 
 /**********************************************************************
@@ -557,9 +1045,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     /* Reset the heap and free any records in the range list */
     mem_reset_brk();
     clear_ranges(ranges);
+    batch_reset();
 
     /* Call the mm package's init function */
-    if (mm_init() < 0) {
+    if (engine->init() < 0) {
 	malloc_error(tracenum, 0, "mm_init failed.");
 	return 0;
     }
@@ -574,7 +1063,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
         case ALLOC: /* mm_malloc */
 
 	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
+	    if ((p = batch_malloc(trace, i)) == NULL) {
 		malloc_error(tracenum, i, "mm_malloc failed.");
 		return 0;
 	    }
@@ -584,7 +1073,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	     * to the range list if OK. The block must be  be aligned properly,
 	     * and must not overlap any currently allocated block. 
 	     */ 
-	    if (add_range(ranges, p, size, tracenum, i) == 0)
+	    if (add_range(ranges, p, size, ALIGNMENT, tracenum, i) == 0)
 		return 0;
 	    
 	    /* ADDED: cgw
@@ -599,11 +1088,55 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    trace->block_sizes[index] = size;
 	    break;
 
+        case CALLOC: /* mm_calloc */
+
+	    /* Call the student's calloc */
+	    if ((p = engine->calloc(1, size)) == NULL) {
+		malloc_error(tracenum, i, "mm_calloc failed.");
+		return 0;
+	    }
+
+	    /* Check the range like mm_malloc's */
+	    if (add_range(ranges, p, size, ALIGNMENT, tracenum, i) == 0)
+		return 0;
+
+	    /* The whole payload must be zero */
+	    for (j = 0; j < size; j++) {
+		if (p[j] != 0) {
+		    malloc_error(tracenum, i, "mm_calloc did not zero the block");
+		    return 0;
+		}
+	    }
+	    memset(p, index & 0xFF, size);
+
+	    /* Remember region */
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+        case MEMALIGN: /* mm_memalign */
+
+	    /* Call the student's memalign */
+	    if ((p = engine->memalign(OP_ALIGN(trace->ops[i]), size)) == NULL) {
+		malloc_error(tracenum, i, "mm_memalign failed.");
+		return 0;
+	    }
+
+	    /* Check the range, including the requested alignment */
+	    if (add_range(ranges, p, size, OP_ALIGN(trace->ops[i]), tracenum, i) == 0)
+		return 0;
+	    memset(p, index & 0xFF, size);
+
+	    /* Remember region */
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
         case REALLOC: /* mm_realloc */
 	    
 	    /* Call the student's realloc */
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp, size)) == NULL) {
+	    if ((newp = engine->realloc(oldp, size)) == NULL) {
 		malloc_error(tracenum, i, "mm_realloc failed.");
 		return 0;
 	    }
@@ -612,7 +1145,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    remove_range(ranges, oldp);
 	    
 	    /* Check new block for correctness and add it to range list */
-	    if (add_range(ranges, newp, size, tracenum, i) == 0)
+	    if (add_range(ranges, newp, size, ALIGNMENT, tracenum, i) == 0)
 		return 0;
 	    
 	    /* ADDED: cgw
@@ -623,7 +1156,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -641,7 +1174,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    /* Remove region from list and call student's free function */
 	    p = trace->blocks[index];
 	    remove_range(ranges, p);
-	    mm_free(p);
+	    batch_free(trace, i, p);
 	    break;
 
 	default:
@@ -663,31 +1196,46 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   package on the trace. Note that our implementation of mem_sbrk() 
  *   doesn't allow the students to decrement the brk pointer, so brk
  *   is always the high water mark of the heap. 
- *   
+ *
+ *   If frag is not NULL, it is set to the internal fragmentation at the
+ *   payload high water mark: the share of the usable bytes of the live
+ *   blocks (from mm_usable_size) that the trace did not ask for.
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   double *frag)
 {   
     int i;
     int index;
     int size, newsize, oldsize;
     int max_total_size = 0;
     int total_size = 0;
+    size_t total_usable = 0;  /* usable bytes of all allocated blocks */
+    double peak_frag = 0;
     char *p;
     char *newp, *oldp;
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
-    if (mm_init() < 0)
+    batch_reset();
+    if (engine->init() < 0)
 	app_error("mm_init failed in eval_mm_util");
 
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_alloc */
+        case CALLOC: /* mm_calloc */
+        case MEMALIGN: /* mm_memalign */
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    if (trace->ops[i].type == CALLOC)
+		p = engine->calloc(1, size);
+	    else if (trace->ops[i].type == MEMALIGN)
+		p = engine->memalign(OP_ALIGN(trace->ops[i]), size);
+	    else
+		p = batch_malloc(trace, i);
+	    if (p == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -697,10 +1245,13 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    /* Keep track of current total size
 	     * of all allocated blocks */
 	    total_size += size;
+	    total_usable += engine->usable_size(p);
 	    
 	    /* Update statistics */
-	    max_total_size = (total_size > max_total_size) ?
-		total_size : max_total_size;
+	    if (total_size > max_total_size) {
+		max_total_size = total_size;
+		peak_frag = 1.0 - (double)total_size / (double)total_usable;
+	    }
 	    break;
 
 	case REALLOC: /* mm_realloc */
@@ -709,7 +1260,8 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp,newsize)) == NULL)
+	    total_usable -= engine->usable_size(oldp);
+	    if ((newp = engine->realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc failed in eval_mm_util");
 
 	    /* Remember region and size */
@@ -719,18 +1271,22 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    /* Keep track of current total size
 	     * of all allocated blocks */
 	    total_size += (newsize - oldsize);
+	    total_usable += engine->usable_size(newp);
 	    
 	    /* Update statistics */
-	    max_total_size = (total_size > max_total_size) ?
-		total_size : max_total_size;
+	    if (total_size > max_total_size) {
+		max_total_size = total_size;
+		peak_frag = 1.0 - (double)total_size / (double)total_usable;
+	    }
 	    break;
 
         case FREE: /* mm_free */
 	    index = trace->ops[i].index;
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
+	    total_usable -= engine->usable_size(p);
 	    
-	    mm_free(p);
+	    batch_free(trace, i, p);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -744,6 +1300,8 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         }
     }
 
+    if (frag != NULL)
+	*frag = peak_frag;
     return ((double)max_total_size / (double)mem_heapsize());
 }
 
@@ -760,7 +1318,8 @@ static void eval_mm_speed(void *ptr)
 
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
-    if (mm_init() < 0) 
+    batch_reset();
+    if (engine->init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
@@ -770,24 +1329,44 @@ static void eval_mm_speed(void *ptr)
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            if ((p = batch_malloc(trace, i)) == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
+
+        case CALLOC: /* mm_calloc */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = engine->calloc(1, size)) == NULL)
+		app_error("mm_calloc error in eval_mm_speed");
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
+
+        case MEMALIGN: /* mm_memalign */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = engine->memalign(OP_ALIGN(trace->ops[i]), size)) == NULL)
+		app_error("mm_memalign error in eval_mm_speed");
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
             break;
 
 	case REALLOC: /* mm_realloc */
 	    index = trace->ops[i].index;
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL)
+            if ((newp = engine->realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
             trace->blocks[index] = newp;
+            trace->block_sizes[index] = newsize;
             break;
 
         case FREE: /* mm_free */
             index = trace->ops[i].index;
             block = trace->blocks[index];
-            mm_free(block);
+            batch_free(trace, i, block);
             break;
 
 	default:
@@ -796,57 +1375,1019 @@ static void eval_mm_speed(void *ptr)
 }
 
 /*
- * eval_libc_valid - We run this function to make sure that the
- *    libc malloc can run to completion on the set of traces.
- *    We'll be conservative and terminate if any libc malloc call fails.
- *
+ * region_op - Replay allocation request opnum (alloc, calloc, memalign or
+ *    realloc) in the region of its id. The region is created on first use.
+ *    A realloc gets a new block from the region and copies the old payload;
+ *    the old block is reclaimed when the region is reset. Returns the new
+ *    block, or NULL if the region is out of memory.
  */
-static int eval_libc_valid(trace_t *trace, int tracenum)
+static char *region_op(trace_t *trace, int opnum, mm_region_t **regions, 
+		       int *live)
 {
-    int i, newsize;
-    char *p, *newp, *oldp;
-
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
-
-        case ALLOC: /* malloc */
-	    if ((p = malloc(trace->ops[i].size)) == NULL) {
-		malloc_error(tracenum, i, "libc malloc failed");
-		unix_error("System message");
-	    }
-	    trace->blocks[trace->ops[i].index] = p;
-	    break;
-
-	case REALLOC: /* realloc */
-            newsize = trace->ops[i].size;
-	    oldp = trace->blocks[trace->ops[i].index];
-	    if ((newp = realloc(oldp, newsize)) == NULL) {
-		malloc_error(tracenum, i, "libc realloc failed");
-		unix_error("System message");
-	    }
-	    trace->blocks[trace->ops[i].index] = newp;
-	    break;
-	    
-        case FREE: /* free */
-	    free(trace->blocks[trace->ops[i].index]);
-	    break;
+    int index = trace->ops[opnum].index;
+    int size = trace->ops[opnum].size;
+    int k = index / region_ids;
+    int align, oldsize;
+    char *p;
 
-	default:
-	    app_error("invalid operation type  in eval_libc_valid");
+    if (regions[k] == NULL && (regions[k] = mm_region_create()) == NULL)
+	return NULL;
+
+    switch (trace->ops[opnum].type) {
+    case ALLOC:
+	p = mm_region_alloc(regions[k], size);
+	break;
+    case CALLOC:
+	if ((p = mm_region_alloc(regions[k], size)) != NULL)
+	    memset(p, 0, size);
+	break;
+    case MEMALIGN:
+	align = OP_ALIGN(trace->ops[opnum]);
+	if ((p = mm_region_alloc(regions[k], size + align - 1)) != NULL)
+	    p = (char *)(((size_t)p + align - 1) & ~(size_t)(align - 1));
+	break;
+    case REALLOC:
+	if ((p = mm_region_alloc(regions[k], size)) != NULL) {
+	    oldsize = trace->block_sizes[index];
+	    memcpy(p, trace->blocks[index], (size < oldsize) ? size : oldsize);
 	}
+	return p;
+    default:
+	app_error("Nonexistent request type in region_op");
+	return NULL;
     }
-
-    return 1;
+    live[k]++;
+    return p;
 }
 
-/* 
- * eval_libc_speed - This is the function that is used by fcyc() to
- *    measure the running time of the libc malloc package on the set
- *    of traces.
+/*
+ * eval_mm_region_valid - Check the mm region package for correctness.
+ *    Every allocation goes to the region of its id; frees only count
+ *    down the live blocks of the region, and the region is reset when
+ *    the count reaches zero.
  */
-static void eval_libc_speed(void *ptr)
+static int eval_mm_region_valid(trace_t *trace, int tracenum, 
+				range_t **ranges)
 {
-    int i;
+    int i, j, k;
+    int index;
+    int size;
+    int align;
+    int oldsize;
+    int nregions = trace->num_ids / region_ids + 1;
+    mm_region_t **regions;
+    int *live;
+    char *p;
+    int ok = 1;
+    
+    /* Reset the heap and free any records in the range list */
+    mem_reset_brk();
+    clear_ranges(ranges);
+
+    if (mm_init() < 0) {
+	malloc_error(tracenum, 0, "mm_init failed.");
+	return 0;
+    }
+    if ((regions = calloc(nregions, sizeof(mm_region_t *))) == NULL ||
+	(live = calloc(nregions, sizeof(int))) == NULL)
+	unix_error("calloc failed in eval_mm_region_valid");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	k = index / region_ids;
+
+	if (trace->ops[i].type == FREE) {
+	    remove_range(ranges, trace->blocks[index]);
+	    if (--live[k] == 0)
+		mm_region_reset(regions[k]);
+	    continue;
+	}
+
+	/* 
+	 * Regions hold on to memory until their last id is freed, so some
+	 * traces do not fit in the heap; that is not an error of mm.c
+	 */
+	if ((p = region_op(trace, i, regions, live)) == NULL) {
+	    printf("Region replay of trace %d ran out of heap at line %d\n",
+		   tracenum, LINENUM(i));
+	    ok = 0;
+	    break;
+	}
+	if (trace->ops[i].type == REALLOC) {
+	    remove_range(ranges, trace->blocks[index]);
+	    oldsize = trace->block_sizes[index];
+	    if (size < oldsize) oldsize = size;
+	    for (j = 0; j < oldsize; j++) {
+		if ((unsigned char)p[j] != (index & 0xFF)) {
+		    malloc_error(tracenum, i, "region realloc did not preserve "
+				 "the data from old block");
+		    ok = 0;
+		    break;
+		}
+	    }
+	    if (!ok)
+		break;
+	}
+	align = (trace->ops[i].type == MEMALIGN) ? OP_ALIGN(trace->ops[i]) : 0;
+	if (add_range(ranges, p, size, align, tracenum, i) == 0) {
+	    ok = 0;
+	    break;
+	}
+	memset(p, index & 0xFF, size);
+	trace->blocks[index] = p;
+	trace->block_sizes[index] = size;
+    }
+
+    free(regions);
+    free(live);
+    return ok;
+}
+
+/*
+ * eval_mm_region_speed - This is the function that is used by fcyc()
+ *    to measure the running time of the trace replayed with regions.
+ */
+static void eval_mm_region_speed(void *ptr)
+{
+    int i, k, index;
+    trace_t *trace = ((speed_t *)ptr)->trace;
+    int nregions = trace->num_ids / region_ids + 1;
+    mm_region_t **regions;
+    int *live;
+    char *p;
+
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_region_speed");
+    if ((regions = calloc(nregions, sizeof(mm_region_t *))) == NULL ||
+	(live = calloc(nregions, sizeof(int))) == NULL)
+	unix_error("calloc failed in eval_mm_region_speed");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	k = index / region_ids;
+	if (trace->ops[i].type == FREE) {
+	    if (--live[k] == 0)
+		mm_region_reset(regions[k]);
+	    continue;
+	}
+	if ((p = region_op(trace, i, regions, live)) == NULL)
+	    app_error("mm_region_alloc error in eval_mm_region_speed");
+	trace->blocks[index] = p;
+	trace->block_sizes[index] = trace->ops[i].size;
+    }
+
+    free(regions);
+    free(live);
+}
+
+/*
+ * eval_mm_stream - Replay the trace at path on mm while it streams in
+ *    from disk, for traces that do not fit in memory. Only failed requests
+ *    are caught; there are no range or data checks. The payload of each
+ *    live id is kept in an idmap, so memory grows with the live blocks,
+ *    not with the ids in the header. Prints the op count,
+ *    the time, how much of it went to waiting for the reader, and the
+ *    final heap size.
+ */
+static void eval_mm_stream(char *path)
+{
+    trace_stream_t *s;
+    traceop_t *ops;
+    uint64_t num_ids, num_ops, opnum = 0;
+    uint64_t *slot;
+    size_t i, n;
+    idmap_t *blocks;
+    char *p;
+    struct timespec start, end, t0, t1;
+    double wait = 0, secs;
+
+    s = open_trace_stream(path, &num_ids, &num_ops);
+    blocks = idmap_new();   /* the payload of each live id */
+
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_stream");
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (;;) {
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	n = next_trace_chunk(s, &ops);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	wait += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	if (n == 0)
+	    break;
+
+	for (i = 0; i < n; i++, opnum++) {
+	    check_size(&ops[i], opnum, path);
+	    switch (ops[i].type) {
+	    case ALLOC:
+		p = mm_malloc(ops[i].size);
+		break;
+	    case CALLOC:
+		p = mm_calloc(1, ops[i].size);
+		break;
+	    case MEMALIGN:
+		p = mm_memalign(OP_ALIGN(ops[i]), ops[i].size);
+		break;
+	    case REALLOC:
+		slot = idmap_find(blocks, ops[i].index);
+		p = mm_realloc(slot != NULL ? (char *)(uintptr_t)*slot : NULL, ops[i].size);
+		break;
+	    case FREE:
+		if ((slot = idmap_find(blocks, ops[i].index)) != NULL) {
+		    free_op(&ops[i], (char *)(uintptr_t)*slot);
+		    idmap_remove(blocks, ops[i].index);
+		}
+		continue;
+	    default:
+		app_error("Nonexistent request type in eval_mm_stream");
+	    }
+	    if (p == NULL && ops[i].size > 0) {
+		sprintf(msg, "mm failed request %llu of %s", 
+			(unsigned long long)opnum, path);
+		app_error(msg);
+	    }
+	    *idmap_add(blocks, ops[i].index) = (uintptr_t)p;
+	}
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    close_trace_stream(s);
+    idmap_free(blocks);
+
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("Streamed %llu ops from %s in %.3f secs (%.0f Kops/s)\n",
+	   (unsigned long long)opnum, path, secs, opnum / 1e3 / secs);
+    printf("Waited %.3f secs for the reader; heap is %lu bytes\n", 
+	   wait, (unsigned long)mem_heapsize());
+    if (opnum != num_ops)
+	printf("Warning: the trace header says %llu ops\n", 
+	       (unsigned long long)num_ops);
+}
+
+/*
+ * eval_mm_checks - Time the trace with mm checking off and at each tier
+ *    up to check_tier, then leave checking at check_tier again.
+ */
+static void eval_mm_checks(speed_t *speed_params, stats_t *stats)
+{
+    int t;
+
+    for (t = -1; t <= check_tier; t++) {
+	mm_setopt(MM_OPT_CHECK, MM_CHECK_LOCAL + t);
+	stats->check_secs[t + 1] = fsecs(eval_mm_speed, speed_params);
+    }
+}
+
+/*
+ * eval_mm_oracle - Evaluate the space utilization of mm when every
+ *    mm_malloc is told the lifetime of its block, i.e. the number of ops
+ *    until the id is next freed or realloc'd. Blocks living fewer than a
+ *    split number of ops are hinted short-lived; the rest keep the default
+ *    placement (hinting them long-lived would undo the size split, as
+ *    long-lived blocks go to the low end whatever their size). Several
+ *    splits are tried; the best utilization is returned and its split
+ *    stored in *split. This is the best of those few short/default splits,
+ *    not a bound on what any lifetime predictor could buy: one that picks
+ *    a class per block, or per allocation site, may do better.
+ */
+static double eval_mm_oracle(trace_t *trace, int tracenum, range_t **ranges,
+			     int *split)
+{
+    static int splits[] = {8, 32, 128, 512, 2048, 8192, 32768};
+    int *next;      /* next op on each id, going backwards through the trace */
+    int *lifetime;  /* ops from each op until its id is used again */
+    int i, k;
+    double util, best = 0;
+
+    if ((next = malloc(trace->num_ids * sizeof(int))) == NULL ||
+	(lifetime = malloc(trace->num_ops * sizeof(int))) == NULL ||
+	(life_hints = malloc(trace->num_ops * sizeof(int))) == NULL)
+	unix_error("malloc failed in eval_mm_oracle");
+
+    for (i = 0; i < trace->num_ids; i++)
+	next[i] = -1;
+    for (i = trace->num_ops - 1; i >= 0; i--) {
+	k = trace->ops[i].index;
+	lifetime[i] = (next[k] < 0) ? trace->num_ops : next[k] - i;
+	next[k] = i;
+    }
+
+    for (k = 0; k < sizeof(splits) / sizeof(splits[0]); k++) {
+	for (i = 0; i < trace->num_ops; i++)
+	    life_hints[i] = (lifetime[i] < splits[k]) ? MM_LIFE_SHORT : MM_LIFE_DEFAULT;
+	util = eval_mm_util(trace, tracenum, ranges, NULL);
+	if (util > best) {
+	    best = util;
+	    *split = splits[k];
+	}
+    }
+
+    free(next);
+    free(lifetime);
+    free(life_hints);
+    life_hints = NULL;
+    return best;
+}
+
+/*
+ * eval_mm_latency - Replay the trace on mm, timing every op on its own,
+ *    with the maintenance thread running if background is set. Sets p50
+ *    and p99 to the median and 99th percentile latency in ns. A trace
+ *    with timestamps is replayed with its think time between ops, up to
+ *    THINK_MAX ns each, which is when the maintenance thread gets to run.
+ */
+static void eval_mm_latency(trace_t *trace, int background, 
+			    double *p50, double *p99)
+{
+    int i, index, size;
+    struct timespec start, end;
+    char *p;
+
+    if ((latencies = realloc(latencies, trace->num_ops * sizeof(double))) == NULL)
+	unix_error("realloc failed in eval_mm_latency");
+
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_latency");
+    if (background && mm_setopt(MM_OPT_BACKGROUND, 1) < 0)
+	app_error("mm maintenance thread failed to start");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	if (trace->times != NULL && i > 0 && trace->times[i] > trace->times[i-1])
+	    think(trace->times[i] - trace->times[i-1]);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    p = mm_malloc(size);
+	    break;
+	case CALLOC:
+	    p = mm_calloc(1, size);
+	    break;
+	case MEMALIGN:
+	    p = mm_memalign(OP_ALIGN(trace->ops[i]), size);
+	    break;
+	case REALLOC:
+	    p = mm_realloc(trace->blocks[index], size);
+	    break;
+	case FREE:
+	    free_op(&trace->ops[i], trace->blocks[index]);
+	    p = trace->blocks[index];
+	    break;
+	default:
+	    app_error("Nonexistent request type in eval_mm_latency");
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (p == NULL)
+	    app_error("mm_malloc error in eval_mm_latency");
+	trace->blocks[index] = p;
+	latencies[i] = (end.tv_sec - start.tv_sec) * 1e9 + 
+	    (end.tv_nsec - start.tv_nsec);
+    }
+    if (background)
+	mm_setopt(MM_OPT_BACKGROUND, 0);
+
+    qsort(latencies, trace->num_ops, sizeof(double), double_cmp);
+    *p50 = latencies[trace->num_ops / 2];
+    *p99 = latencies[(int)(trace->num_ops * 0.99)];
+}
+
+/*
+ * think - Spin for ns nanoseconds, or THINK_MAX if that is less
+ */
+static void think(uint64_t ns)
+{
+    struct timespec start, now;
+
+    if (ns > THINK_MAX)
+	ns = THINK_MAX;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+	clock_gettime(CLOCK_MONOTONIC, &now);
+    } while ((uint64_t)((now.tv_sec - start.tv_sec) * 1000000000LL + 
+			(now.tv_nsec - start.tv_nsec)) < ns);
+}
+
+/* qsort comparator for doubles in increasing order */
+static int double_cmp(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * eval_mm_scaling - Time replay of the trace on 1, 2, ... scale_threads
+ *    threads. A trace with a thread column is split by it, trace thread t
+ *    going to thread t % n, and an op on a block of another thread waits
+ *    until that thread's earlier ops on the block are done, so blocks can
+ *    be freed on other threads than the ones that allocated them. Any
+ *    other trace is replayed whole by every thread, each with its own ids.
+ */
+static void eval_mm_scaling(trace_t *trace, stats_t *stats)
+{
+    unsigned *nth = NULL, *seen;
+    int i, n;
+
+    stats->scale = calloc(scale_threads, sizeof(scale_t));
+    if (stats->scale == NULL)
+	unix_error("calloc failed in eval_mm_scaling");
+    stats->scale_split = (trace->flags & TRACE_THREADS) != 0;
+
+    /* Number each op among the ops on its id, the order threads keep */
+    if (stats->scale_split) {
+	nth = malloc(trace->num_ops * sizeof(unsigned));
+	seen = calloc(trace->num_ids, sizeof(unsigned));
+	if (nth == NULL || seen == NULL)
+	    unix_error("malloc failed in eval_mm_scaling");
+	for (i = 0; i < trace->num_ops; i++)
+	    nth[i] = seen[trace->ops[i].index]++;
+	free(seen);
+    }
+    for (n = 1; n <= scale_threads; n++)
+	if (!scale_run(trace, n, stats->scale_split, nth, 0, &stats->scale[n - 1]))
+	    break;
+    free(nth);
+}
+
+/*
+ * eval_mm_threads - Replay the trace on mm_threads threads at once, each
+ *    with its own ids as a -T run of copies, with or without cache-line
+ *    blocks (line). After every op a thread also writes to the payloads
+ *    of the last MT_HOT blocks it allocated, so neighbours handed to
+ *    different threads contend for their cache lines. Returns the Kops/s
+ *    of all threads, or 0 if the heap ran out.
+ */
+static double eval_mm_threads(trace_t *trace, int line)
+{
+    scale_t scale;
+
+    mm_setopt(MM_OPT_LINE_BLOCKS, line);
+    scale_run(trace, mm_threads, 0, NULL, 1, &scale);
+    mm_setopt(MM_OPT_LINE_BLOCKS, 0);
+    return scale.total;
+}
+
+/*
+ * scale_run - Replay the trace on n threads released together by a
+ *    barrier, and set the throughput of all, over the time from the first
+ *    thread's start to the last one's end, and of each. Each thread also
+ *    writes to its hot blocks if hot is set, which needs copies (!split).
+ *    Returns 0 if the heap ran out.
+ */
+static int scale_run(trace_t *trace, int n, int split, unsigned *nth, int hot,
+		     scale_t *scale)
+{
+    scale_thread_t *threads;
+    pthread_barrier_t start;
+    double begin = DBL_MAX, end = 0;
+    char **shared = NULL;
+    unsigned *done = NULL;
+    volatile int stop = 0;
+    double kops, total = 0;
+    int i, t, busy = 0, ok = 1;
+
+    if ((threads = calloc(n, sizeof(scale_thread_t))) == NULL)
+	unix_error("calloc failed in scale_run");
+    if (split) {
+	shared = calloc(trace->num_ids, sizeof(char *));
+	done = calloc(trace->num_ids, sizeof(unsigned));
+	if (shared == NULL || done == NULL)
+	    unix_error("calloc failed in scale_run");
+	for (t = 0; t < n; t++)
+	    if ((threads[t].ops = malloc(trace->num_ops * sizeof(int))) == NULL)
+		unix_error("malloc failed in scale_run");
+	for (i = 0; i < trace->num_ops; i++) {
+	    t = trace->ops[i].thread % n;
+	    threads[t].ops[threads[t].num_ops++] = i;
+	}
+    }
+    for (t = 0; t < n; t++) {
+	threads[t].trace = trace;
+	threads[t].nth = nth;
+	threads[t].stop = &stop;
+	threads[t].start = &start;
+	threads[t].hot = hot && !split;
+	if (split) {
+	    threads[t].blocks = shared;
+	    threads[t].done = done;
+	} else {
+	    threads[t].num_ops = trace->num_ops;
+	    if ((threads[t].blocks = calloc(trace->num_ids, sizeof(char *))) == NULL)
+		unix_error("calloc failed in scale_run");
+	}
+    }
+
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in scale_run");
+    mm_setopt(MM_OPT_THREADS, 1);
+    if (pthread_barrier_init(&start, NULL, n) != 0)
+	unix_error("pthread_barrier_init failed in scale_run");
+    for (t = 0; t < n; t++)
+	if (pthread_create(&threads[t].tid, NULL, scale_replay, &threads[t]) != 0)
+	    unix_error("pthread_create failed in scale_run");
+    for (t = 0; t < n; t++) {
+	pthread_join(threads[t].tid, NULL);
+	ok = ok && !threads[t].failed;
+    }
+    pthread_barrier_destroy(&start);
+    mm_setopt(MM_OPT_THREADS, 0);
+
+    memset(scale, 0, sizeof(*scale));
+    if (ok) {
+	if (verbose > 1)
+	    printf("%d threads (Kops/s):", n);
+	for (t = 0; t < n; t++) {
+	    total += threads[t].num_ops;
+	    begin = threads[t].begin < begin ? threads[t].begin : begin;
+	    end = threads[t].end > end ? threads[t].end : end;
+	    if (threads[t].num_ops == 0 || threads[t].end <= threads[t].begin)
+		continue;
+	    kops = threads[t].num_ops / 1e3 / (threads[t].end - threads[t].begin);
+	    if (verbose > 1)
+		printf(" %.0f", kops);
+	    scale->min = busy == 0 || kops < scale->min ? kops : scale->min;
+	    scale->max = kops > scale->max ? kops : scale->max;
+	    scale->avg += kops;
+	    busy++;
+	}
+	if (verbose > 1)
+	    printf("\n");
+	scale->avg = busy ? scale->avg / busy : 0;
+	scale->total = total / 1e3 / (end - begin);
+    }
+
+    for (t = 0; t < n; t++) {
+	free(threads[t].ops);
+	if (!split)
+	    free(threads[t].blocks);
+    }
+    free(threads);
+    free(shared);
+    free(done);
+    return ok;
+}
+
+/*
+ * scale_replay - The body of one scale_run thread. With shared ids, an op
+ *    first waits until the ops before it on its id are done. A hot thread
+ *    fills the payload of each new block, and each of its hot blocks gets
+ *    its first and last bytes bumped after every op.
+ */
+static void *scale_replay(void *ptr)
+{
+    scale_thread_t *t = (scale_thread_t *)ptr;
+    trace_t *trace = t->trace;
+    traceop_t *op;
+    struct timespec now;
+    char *hot[MT_HOT];
+    int hot_size[MT_HOT];
+    int i, j, k, index, next = 0;
+    char *p, *old;
+
+    memset(hot, 0, sizeof(hot));
+    pthread_barrier_wait(t->start);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    t->begin = now.tv_sec + now.tv_nsec / 1e9;
+    for (j = 0; j < t->num_ops; j++) {
+	i = t->ops != NULL ? t->ops[j] : j;
+	op = &trace->ops[i];
+	index = op->index;
+	if (t->done != NULL) {
+	    while (t->done[index] != t->nth[i]) {
+		if (*t->stop)
+		    return NULL;
+		sched_yield();
+	    }
+	    __sync_synchronize();
+	}
+	old = t->blocks[index];
+	switch (op->type) {
+	case ALLOC:
+	    p = mm_malloc(op->size);
+	    break;
+	case CALLOC:
+	    p = mm_calloc(1, op->size);
+	    break;
+	case MEMALIGN:
+	    p = mm_memalign(OP_ALIGN(*op), op->size);
+	    break;
+	case REALLOC:
+	    p = mm_realloc(old, op->size);
+	    break;
+	case FREE:
+	    free_op(op, old);
+	    p = NULL;
+	    break;
+	default:
+	    app_error("Nonexistent request type in scale_replay");
+	}
+	if (p == NULL && op->type != FREE) {
+	    t->failed = 1;
+	    *t->stop = 1;
+	    return NULL;
+	}
+	t->blocks[index] = p;
+
+	/* The block of index leaves the hot set; a new one joins it */
+	if (t->hot) {
+	    for (k = 0; k < MT_HOT; k++)
+		if (hot[k] == old)
+		    hot[k] = NULL;
+	    if (p != NULL && op->size > 0) {
+		memset(p, index & 0xFF, op->size);
+		hot[next] = p;
+		hot_size[next] = op->size;
+		next = (next + 1) % MT_HOT;
+	    }
+	    for (k = 0; k < MT_HOT; k++) {
+		if (hot[k] != NULL) {
+		    hot[k][0]++;
+		    hot[k][hot_size[k] - 1]++;
+		}
+	    }
+	}
+	if (t->done != NULL) {
+	    __sync_synchronize();
+	    t->done[index] = t->nth[i] + 1;
+	}
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    t->end = now.tv_sec + now.tv_nsec / 1e9;
+    return NULL;
+}
+
+/*
+ * eval_mm_snapshot - Build the heap of the first snapshot_ops ops of the
+ *    trace in a file-backed heap and checkpoint mm. Time a replay of those
+ *    ops on a fresh heap, and a restore of the saved heap and checkpoint.
+ *    The restored heap must hold every live payload and run the rest of
+ *    the trace. Returns 0 on an error.
+ */
+static int eval_mm_snapshot(trace_t *trace, int tracenum, stats_t *stats)
+{
+    snapshot_t snap;
+    int index, j;
+    int ok = 1;
+    char *p;
+
+    snap.trace = trace;
+    snap.prefix = (snapshot_ops < trace->num_ops) ? snapshot_ops : trace->num_ops;
+    sprintf(snap.heap_path, "/tmp/mdriver.%d.heap", (int)getpid());
+    sprintf(snap.meta_path, "/tmp/mdriver.%d.meta", (int)getpid());
+
+    /* The baseline: replay the prefix */
+    stats->snap_replay_secs = fsecs(snapshot_replay, &snap);
+
+    /* Build the prefix in a file-backed heap and save the mm metadata */
+    mem_deinit();
+    if (mem_init_file(snap.heap_path, 1) < 0) {
+	printf("Snapshot of trace %d skipped: cannot map %s: %s\n", tracenum, 
+	       snap.heap_path, strerror(errno));
+	mem_init();
+	return 0;
+    }
+    memset(trace->blocks, 0, trace->num_ids * sizeof(char *));
+    if (mm_init() < 0 || !replay_ops(trace, tracenum, 0, snap.prefix))
+	ok = 0;
+    else if (mm_checkpoint(snap.meta_path) < 0)
+	unix_error("mm_checkpoint failed in eval_mm_snapshot");
+
+    if (ok) {
+	stats->snap_restore_secs = fsecs(snapshot_restore, &snap);
+
+	/* The restored heap must hold the live blocks and keep working */
+	for (index = 0; ok && index < trace->num_ids; index++) {
+	    if ((p = trace->blocks[index]) == NULL)
+		continue;
+	    for (j = 0; j < trace->block_sizes[index]; j++) {
+		if ((unsigned char)p[j] != (index & 0xFF)) {
+		    malloc_error(tracenum, snap.prefix, "mm_restore did not "
+				 "preserve the data of a block");
+		    ok = 0;
+		    break;
+		}
+	    }
+	}
+	ok = ok && replay_ops(trace, tracenum, snap.prefix, trace->num_ops);
+    }
+
+    mem_deinit();
+    unlink(snap.heap_path);
+    unlink(snap.meta_path);
+    mem_init();
+    if (!ok)
+	stats->snap_restore_secs = 0;
+    return ok;
+}
+
+/*
+ * snapshot_replay - This is the function that is used by fsecs() to
+ *    time mm_init and the replay of the snapshot prefix.
+ */
+static void snapshot_replay(void *ptr)
+{
+    snapshot_t *snap = (snapshot_t *)ptr;
+
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in snapshot_replay");
+    if (!replay_ops(snap->trace, 0, 0, snap->prefix))
+	app_error("mm replay failed in snapshot_replay");
+}
+
+/*
+ * snapshot_restore - This is the function that is used by fsecs() to
+ *    time mapping the saved heap again and mm_restore.
+ */
+static void snapshot_restore(void *ptr)
+{
+    snapshot_t *snap = (snapshot_t *)ptr;
+
+    mem_deinit();
+    if (mem_init_file(snap->heap_path, 0) < 0)
+	unix_error("mem_init_file failed in snapshot_restore");
+    if (mm_restore(snap->meta_path) < 0)
+	app_error("mm_restore failed in snapshot_restore");
+}
+
+/*
+ * replay_ops - Replay requests [from, to) of the trace on mm, filling each
+ *    payload with the low byte of its id and checking that realloc keeps
+ *    it. Freed ids get a NULL block. Returns 0 on an error.
+ */
+static int replay_ops(trace_t *trace, int tracenum, int from, int to)
+{
+    int i, j, index, size, oldsize;
+    char *p;
+
+    for (i = from; i < to; i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    p = mm_malloc(size);
+	    break;
+	case CALLOC:
+	    p = mm_calloc(1, size);
+	    break;
+	case MEMALIGN:
+	    p = mm_memalign(OP_ALIGN(trace->ops[i]), size);
+	    break;
+	case REALLOC:
+	    if ((p = mm_realloc(trace->blocks[index], size)) == NULL)
+		break;
+	    oldsize = trace->block_sizes[index];
+	    if (size < oldsize) oldsize = size;
+	    for (j = 0; j < oldsize; j++) {
+		if ((unsigned char)p[j] != (index & 0xFF)) {
+		    malloc_error(tracenum, i, "mm_realloc did not preserve the "
+				 "data from old block");
+		    return 0;
+		}
+	    }
+	    break;
+	case FREE:
+	    free_op(&trace->ops[i], trace->blocks[index]);
+	    trace->blocks[index] = NULL;
+	    continue;
+	default:
+	    app_error("Nonexistent request type in replay_ops");
+	}
+	if (p == NULL) {
+	    malloc_error(tracenum, i, "mm_malloc failed.");
+	    return 0;
+	}
+	memset(p, index & 0xFF, size);
+	trace->blocks[index] = p;
+	trace->block_sizes[index] = size;
+    }
+    return 1;
+}
+
+/*
+ * eval_mm_compact - Replay the trace with every alloc, calloc and realloc
+ *    going through an mm handle (memalign blocks stay ordinary pinned
+ *    blocks) and run mm_compact every compact_ops ops. Payloads are checked
+ *    after each compaction. Returns 0 on an error.
+ */
+static int eval_mm_compact(trace_t *trace, int tracenum, stats_t *stats)
+{
+    int i, j;
+    int index;
+    int size, oldsize;
+    mm_handle_t **handles;
+    mm_handle_t *h;
+    char *p;
+
+    mem_reset_brk();
+    if (mm_init() < 0) {
+	malloc_error(tracenum, 0, "mm_init failed.");
+	return 0;
+    }
+    if ((handles = calloc(trace->num_ids, sizeof(mm_handle_t *))) == NULL)
+	unix_error("calloc failed in eval_mm_compact");
+    memset(trace->blocks, 0, trace->num_ids * sizeof(char *));
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+
+	switch (trace->ops[i].type) {
+
+	case ALLOC: /* mm_halloc */
+	case CALLOC:
+	    if ((h = mm_halloc(size)) == NULL) {
+		malloc_error(tracenum, i, "mm_halloc failed.");
+		free(handles);
+		return 0;
+	    }
+	    handles[index] = h;
+	    memset(mm_hlock(h), index & 0xFF, size);
+	    mm_hunlock(h);
+	    break;
+
+	case MEMALIGN: /* mm_memalign */
+	    if ((p = mm_memalign(OP_ALIGN(trace->ops[i]), size)) == NULL) {
+		malloc_error(tracenum, i, "mm_memalign failed.");
+		free(handles);
+		return 0;
+	    }
+	    trace->blocks[index] = p;
+	    memset(p, index & 0xFF, size);
+	    break;
+
+	case REALLOC: /* mm_hrealloc, or mm_realloc for memalign blocks */
+	    oldsize = trace->block_sizes[index];
+	    if (size < oldsize) oldsize = size;
+	    if ((h = handles[index]) != NULL)
+		p = (mm_hrealloc(h, size) < 0) ? NULL : mm_hlock(h);
+	    else
+		p = trace->blocks[index] = mm_realloc(trace->blocks[index], size);
+	    if (p == NULL) {
+		malloc_error(tracenum, i, "mm_hrealloc failed.");
+		free(handles);
+		return 0;
+	    }
+	    for (j = 0; j < oldsize; j++) {
+		if ((unsigned char)p[j] != (index & 0xFF)) {
+		    malloc_error(tracenum, i, "mm_hrealloc did not preserve the "
+				 "data from old block");
+		    free(handles);
+		    return 0;
+		}
+	    }
+	    memset(p, index & 0xFF, size);
+	    if (h != NULL)
+		mm_hunlock(h);
+	    break;
+
+	case FREE: /* mm_hfree */
+	    if (handles[index] != NULL)
+		mm_hfree(handles[index]);
+	    else
+		free_op(&trace->ops[i], trace->blocks[index]);
+	    handles[index] = NULL;
+	    trace->blocks[index] = NULL;
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_compact");
+	}
+	if (trace->ops[i].type != FREE)
+	    trace->block_sizes[index] = size;
+
+	if ((i + 1) % compact_ops == 0 && 
+	    !compact_pass(trace, tracenum, i, handles, stats)) {
+	    free(handles);
+	    return 0;
+	}
+    }
+
+    free(handles);
+    return 1;
+}
+
+/*
+ * compact_pass - Run mm_compact after request opnum and add the heap size
+ *    before and after it to stats. Every 16th live handle is locked across
+ *    the pass and must not move; all live payloads must be intact.
+ */
+static int compact_pass(trace_t *trace, int tracenum, int opnum,
+			mm_handle_t **handles, stats_t *stats)
+{
+    int index, j;
+    char *p;
+
+    for (index = 0; index < trace->num_ids; index += 16)
+	if (handles[index] != NULL)
+	    trace->blocks[index] = mm_hlock(handles[index]);
+
+    stats->heap_before += mem_heapsize();
+    mm_compact();
+    stats->heap_after += mem_heapsize();
+    stats->compactions++;
+
+    for (index = 0; index < trace->num_ids; index++) {
+	if (handles[index] != NULL) {
+	    p = mm_hlock(handles[index]);
+	    if (index % 16 == 0) {
+		if (p != trace->blocks[index]) {
+		    malloc_error(tracenum, opnum, "mm_compact moved a locked block");
+		    return 0;
+		}
+		mm_hunlock(handles[index]);
+		trace->blocks[index] = NULL;
+	    }
+	    mm_hunlock(handles[index]);
+	}
+	else if ((p = trace->blocks[index]) == NULL) {
+	    continue;
+	}
+	for (j = 0; j < trace->block_sizes[index]; j++) {
+	    if ((unsigned char)p[j] != (index & 0xFF)) {
+		malloc_error(tracenum, opnum, "mm_compact did not preserve "
+			     "the data of a block");
+		return 0;
+	    }
+	}
+    }
+    return 1;
+}
+
+/*
+ * eval_libc_valid - We run this function to make sure that the
+ *    libc malloc can run to completion on the set of traces.
+ *    We'll be conservative and terminate if any libc malloc call fails.
+ *
+ */
+static int eval_libc_valid(trace_t *trace, int tracenum)
+{
+    int i, newsize;
+    char *p, *newp, *oldp;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* malloc */
+	    if ((p = malloc(trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "libc malloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+        case CALLOC: /* calloc */
+	    if ((p = calloc(1, trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "libc calloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+        case MEMALIGN: /* memalign */
+	    if ((p = memalign(OP_ALIGN(trace->ops[i]), trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "libc memalign failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+	case REALLOC: /* realloc */
+            newsize = trace->ops[i].size;
+	    oldp = trace->blocks[trace->ops[i].index];
+	    if ((newp = realloc(oldp, newsize)) == NULL) {
+		malloc_error(tracenum, i, "libc realloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = newp;
+	    break;
+	    
+        case FREE: /* free */
+	    free(trace->blocks[trace->ops[i].index]);
+	    break;
+
+	default:
+	    app_error("invalid operation type  in eval_libc_valid");
+	}
+    }
+
+    return 1;
+}
+
+/* 
+ * eval_libc_speed - This is the function that is used by fcyc() to
+ *    measure the running time of the libc malloc package on the set
+ *    of traces.
+ */
+static void eval_libc_speed(void *ptr)
+{
+    int i;
     int index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
@@ -861,6 +2402,22 @@ static void eval_libc_speed(void *ptr)
 	    trace->blocks[index] = p;
 	    break;
 
+        case CALLOC: /* calloc */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if ((p = calloc(1, size)) == NULL)
+		unix_error("calloc failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    break;
+
+        case MEMALIGN: /* memalign */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if ((p = memalign(OP_ALIGN(trace->ops[i]), size)) == NULL)
+		unix_error("memalign failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    break;
+
 	case REALLOC: /* realloc */
 	    index = trace->ops[i].index;
 	    newsize = trace->ops[i].size;
@@ -894,52 +2451,318 @@ static void printresults(int n, stats_t *stats)
     double secs = 0;
     double ops = 0;
     double util = 0;
+    double frag = 0;
+    double load = 0;
 
     /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n", 
-	   "trace", " valid", "util", "ops", "secs", "Kops");
+    printf("%5s%7s %5s%6s%8s%10s%6s%10s\n", 
+	   "trace", " valid", "util", "ifrag", "ops", "secs", "Kops", "load");
     for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	    printf("%2d%10s%5.0f%%%5.1f%%%8.0f%10.6f%6.0f%10.6f\n", 
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
+		   stats[i].frag*100.0,
 		   stats[i].ops,
 		   stats[i].secs,
-		   (stats[i].ops/1e3)/stats[i].secs);
+		   (stats[i].ops/1e3)/stats[i].secs,
+		   stats[i].load_secs);
 	    secs += stats[i].secs;
 	    ops += stats[i].ops;
 	    util += stats[i].util;
+	    frag += stats[i].frag;
 	}
 	else {
-	    printf("%2d%10s%6s%8s%10s%6s\n", 
+	    printf("%2d%10s%6s%6s%8s%10s%6s%10.6f\n", 
 		   i,
 		   "no",
 		   "-",
 		   "-",
 		   "-",
-		   "-");
+		   "-",
+		   "-",
+		   stats[i].load_secs);
 	}
+	load += stats[i].load_secs;
     }
 
     /* Print the aggregate results for the set of traces */
     if (errors == 0) {
-	printf("%12s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	printf("%12s%5.0f%%%5.1f%%%8.0f%10.6f%6.0f%10.6f\n", 
 	       "Total       ",
 	       (util/n)*100.0,
+	       (frag/n)*100.0,
 	       ops, 
 	       secs,
-	       (ops/1e3)/secs);
+	       (ops/1e3)/secs,
+	       load);
     }
     else {
-	printf("%12s%6s%8s%10s%6s\n", 
+	printf("%12s%6s%6s%8s%10s%6s%10.6f\n", 
 	       "Total       ",
 	       "-", 
 	       "-", 
 	       "-", 
-	       "-");
+	       "-", 
+	       "-",
+	       load);
+    }
+
+}
+
+/*
+ * printplacement - prints the utilization of each trace before (low-end
+ *     placement) and after (size-segregated placement) for the -p flag
+ */
+static void printplacement(int n, stats_t *stats, size_t split)
+{
+    int i;
+    double before = 0;
+    double after = 0;
+
+    printf("Placement (split at %u bytes):\n", (unsigned)split);
+    printf("%5s%9s%8s\n", "trace", "before", "after");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%11.0f%%%7.0f%%\n",
+		   i,
+		   stats[i].util_low*100.0,
+		   stats[i].util*100.0);
+	    before += stats[i].util_low;
+	    after += stats[i].util;
+	}
+	else {
+	    printf("%2d%12s%8s\n", i, "-", "-");
+	}
+    }
+    printf("%5s%7.0f%%%7.0f%%\n", "Total", (before/n)*100.0, (after/n)*100.0);
+}
+
+/*
+ * printregions - prints the throughput of each trace with ordinary
+ *     frees next to its throughput with regions, for the -r flag
+ */
+static void printregions(int n, stats_t *stats)
+{
+    int i;
+    double secs = 0;
+    double region_secs = 0;
+    double ops = 0;
+
+    printf("Regions (%d ids per region):\n", region_ids);
+    printf("%5s%8s%8s%8s\n", "trace", "Kops", "region", "gain");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid && stats[i].region_secs > 0) {
+	    printf("%2d%11.0f%8.0f%7.2fx\n",
+		   i,
+		   (stats[i].ops/1e3)/stats[i].secs,
+		   (stats[i].ops/1e3)/stats[i].region_secs,
+		   stats[i].secs/stats[i].region_secs);
+	    secs += stats[i].secs;
+	    region_secs += stats[i].region_secs;
+	    ops += stats[i].ops;
+	}
+	else {
+	    printf("%2d%11s%8s%8s\n", i, "-", "-", "-");
+	}
+    }
+    if (region_secs > 0)
+	printf("%5s%8.0f%8.0f%7.2fx\n", "Total", (ops/1e3)/secs, 
+	       (ops/1e3)/region_secs, secs/region_secs);
+}
+
+/*
+ * printcompaction - prints the mean heap size before and after the
+ *     compaction passes of each trace, for the -c flag
+ */
+static void printcompaction(int n, stats_t *stats)
+{
+    int i;
+    double before = 0;
+    double after = 0;
+
+    printf("Compaction (every %d ops):\n", compact_ops);
+    printf("%5s%8s%10s%10s%8s\n", "trace", "passes", "before", "after", "shrink");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid && stats[i].compactions > 0) {
+	    printf("%2d%11d%9.0fK%9.0fK%7.0f%%\n",
+		   i,
+		   stats[i].compactions,
+		   stats[i].heap_before / stats[i].compactions / 1024,
+		   stats[i].heap_after / stats[i].compactions / 1024,
+		   (1.0 - stats[i].heap_after / stats[i].heap_before) * 100.0);
+	    before += stats[i].heap_before / stats[i].compactions;
+	    after += stats[i].heap_after / stats[i].compactions;
+	}
+	else {
+	    printf("%2d%11s%10s%10s%8s\n", i, "-", "-", "-", "-");
+	}
     }
+    if (before > 0)
+	printf("%5s%17.0fK%9.0fK%7.0f%%\n", "Total", before / 1024, after / 1024,
+	       (1.0 - after / before) * 100.0);
+}
+
+/*
+ * printlatency - prints the median and 99th percentile op latency of
+ *     each trace without and with the mm maintenance thread, for -B
+ */
+static void printlatency(int n, stats_t *stats)
+{
+    int i;
 
+    printf("Op latency in ns (without / with maintenance thread):\n");
+    printf("%5s%9s%9s%9s%9s\n", "trace", "p50", "p50 bg", "p99", "p99 bg");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid)
+	    printf("%2d%12.0f%9.0f%9.0f%9.0f\n", i, stats[i].p50[0], 
+		   stats[i].p50[1], stats[i].p99[0], stats[i].p99[1]);
+	else
+	    printf("%2d%12s%9s%9s%9s\n", i, "-", "-", "-", "-");
+    }
+}
+
+/*
+ * printoracle - prints the utilization of each trace next to its
+ *     utilization with the best oracle split, for the -o flag
+ */
+static void printoracle(int n, stats_t *stats)
+{
+    int i;
+    double util = 0;
+    double oracle = 0;
+
+    printf("Best oracle split of lifetime hints:\n");
+    printf("%5s%8s%8s%8s\n", "trace", "util", "oracle", "split");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%10.0f%%%7.0f%%%8d\n",
+		   i,
+		   stats[i].util*100.0,
+		   stats[i].util_oracle*100.0,
+		   stats[i].oracle_split);
+	    util += stats[i].util;
+	    oracle += stats[i].util_oracle;
+	}
+	else {
+	    printf("%2d%11s%8s%8s\n", i, "-", "-", "-");
+	}
+    }
+    printf("%5s%6.0f%%%7.0f%%\n", "Total", (util/n)*100.0, (oracle/n)*100.0);
+}
+
+/*
+ * printsnapshot - prints the time to replay the first snapshot_ops ops
+ *     of each trace next to the time to restore them instead, for -S
+ */
+static void printsnapshot(int n, stats_t *stats)
+{
+    int i;
+
+    printf("Snapshot after %d ops (msecs):\n", snapshot_ops);
+    printf("%5s%9s%9s%9s\n", "trace", "replay", "restore", "gain");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid && stats[i].snap_restore_secs > 0)
+	    printf("%2d%12.3f%9.3f%8.1fx\n", i, 
+		   stats[i].snap_replay_secs * 1e3,
+		   stats[i].snap_restore_secs * 1e3,
+		   stats[i].snap_replay_secs / stats[i].snap_restore_secs);
+	else
+	    printf("%2d%12s%9s%9s\n", i, "-", "-", "-");
+    }
+}
+
+/*
+ * printthreads - prints the throughput of replay of each trace on
+ *     mm_threads threads with packed and with cache-line blocks, for -m
+ */
+static void printthreads(int n, stats_t *stats)
+{
+    int i;
+
+    printf("Replay on %d threads (Kops/s):\n", mm_threads);
+    printf("%5s%9s%9s%9s\n", "trace", "packed", "lines", "gain");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid && stats[i].mt_kops[0] > 0 && stats[i].mt_kops[1] > 0)
+	    printf("%2d%12.0f%9.0f%8.2fx\n", i, 
+		   stats[i].mt_kops[0], stats[i].mt_kops[1],
+		   stats[i].mt_kops[1] / stats[i].mt_kops[0]);
+	else
+	    printf("%2d%12s%9s%9s\n", i, "-", "-", "-");
+    }
+}
+
+/*
+ * printscaling - prints the throughput of all threads and of each thread
+ *     replaying each trace on 1..scale_threads threads, for -T
+ */
+static void printscaling(int n, stats_t *stats)
+{
+    int i, t;
+    scale_t *s;
+
+    printf("Replay on 1..%d threads (Kops/s), split by thread column or copies:\n",
+	   scale_threads);
+    printf("%5s%8s%8s%10s%9s%9s%9s%9s\n", "trace", "mode", "threads", "total",
+	   "speedup", "min", "avg", "max");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid || stats[i].scale == NULL) {
+	    printf("%2d%11s\n", i, "-");
+	    continue;
+	}
+	for (t = 0; t < scale_threads; t++) {
+	    s = &stats[i].scale[t];
+	    if (t == 0)
+		printf("%2d%11s", i, stats[i].scale_split ? "split" : "copies");
+	    else
+		printf("%13s", "");
+	    if (s->total > 0)
+		printf("%8d%10.0f%8.2fx%9.0f%9.0f%9.0f\n", t + 1, s->total,
+		       s->total / stats[i].scale[0].total, s->min, s->avg, s->max);
+	    else
+		printf("%8d%10s%9s%9s%9s%9s\n", t + 1, "-", "-", "-", "-", "-");
+	}
+    }
+}
+
+/*
+ * printchecks - prints the throughput of each trace with mm checking off
+ *     and at each tier up to the one selected by -k, and what each costs
+ */
+static void printchecks(int n, stats_t *stats)
+{
+    int i, t;
+    double ops = 0, secs[4] = {0, 0, 0, 0};
+
+    printf("Throughput in Kops/s by check tier:\n");
+    printf("%5s%9s%9s%9s%9s\n", "trace", "off", "tier 0", "tier 1", "tier 2");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%12s%9s%9s%9s\n", i, "-", "-", "-", "-");
+	    continue;
+	}
+	ops += stats[i].ops;
+	printf("%2d%3s", i, "");
+	for (t = 0; t < 4; t++) {
+	    secs[t] += stats[i].check_secs[t];
+	    if (t <= check_tier + 1)
+		printf("%9.0f", stats[i].ops / 1e3 / stats[i].check_secs[t]);
+	    else
+		printf("%9s", "-");
+	}
+	printf("\n");
+    }
+    if (ops == 0)
+	return;
+    printf("%5s%9s", "cost", "");
+    for (t = 1; t < 4; t++) {
+	if (t <= check_tier + 1)
+	    printf("%8.0f%%", (secs[t] / secs[0] - 1) * 100);
+	else
+	    printf("%9s", "-");
+    }
+    printf("\n");
 }
 
 /* 
@@ -974,13 +2797,26 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVl] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvVlpbBo] [-f <file>] [-F <file>] [-t <dir>] [-s <size>] [-r <n>] [-c <n>] [-S <n>] [-m <n>] [-T <n>] [-k <tier>] [-e <engine>]\n");
     fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-b         Replay runs of allocs and frees in batches.\n");
+    fprintf(stderr, "\t-B         Compare op latency without and with the mm maintenance thread.\n");
+    fprintf(stderr, "\t-c <n>     Also replay with handles, compacting every <n> ops.\n");
+    fprintf(stderr, "\t-e <name>  Replay on engine <name>: mm (default) or buddy.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-F <file>  Only stream <file> through mm, for traces too big to load.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-o         Compare utilization with the best oracle split of lifetime hints.\n");
+    fprintf(stderr, "\t-p         Compare utilization before/after size-segregated placement.\n");
+    fprintf(stderr, "\t-r <n>     Also replay with every <n> ids sharing a region.\n");
+    fprintf(stderr, "\t-k <tier>  Run mm with heap checking of tier 0, 1 or 2 and time each tier.\n");
+    fprintf(stderr, "\t-m <n>     Time replay on <n> threads with packed and cache-line blocks.\n");
+    fprintf(stderr, "\t-S <n>     Snapshot mm after <n> ops and time restore against replay.\n");
+    fprintf(stderr, "\t-s <size>  Size threshold for size-segregated placement (0 = off).\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <n>     Time replay on 1..<n> threads, splitting the trace by its thread column or replaying copies.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
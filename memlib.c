@@ -10,6 +10,7 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 
 #include "memlib.h"
 #include "config.h"
@@ -18,28 +19,90 @@
 static char *mem_start_brk;  /* points to first byte of heap */
 static char *mem_brk;        /* points to last byte of heap */
 static char *mem_max_addr;   /* largest legal heap address */ 
+static char *mem_clean_brk;  /* bytes at or above this were never handed out */
+static size_t mem_size;      /* bytes mapped for the heap */
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    if (mem_init_size(MAX_HEAP) < 0) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
+}
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
+/*
+ * mem_init_size - initialize the memory system model with room for a heap
+ *    of size bytes. The room is only reserved: pages take memory when the
+ *    heap first touches them, so a heap for a whole process (see mmshim.c)
+ *    can be given gigabytes. Returns 0, or -1 if it cannot be mapped.
+ */
+int mem_init_size(size_t size)
+{
+    /* 
+     * allocate the storage we will use to model the available VM;
+     * anonymous mappings are zero-filled, which mm_calloc relies on
+     */
+    mem_start_brk = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem_start_brk == (char *)MAP_FAILED)
+	return -1;
+
+    mem_size = size;
+    mem_max_addr = mem_start_brk + size;      /* max legal heap address */
     mem_brk = mem_start_brk;                  /* heap is empty initially */
+    mem_clean_brk = mem_start_brk;            /* and all of it is zero */
+    return 0;
+}
+
+/*
+ * mem_init_file - initialize the memory system model with a heap backed by
+ *    the file at path, mapped at MEM_FILE_BASE. With create set the file is
+ *    made empty and so is the heap. Otherwise the file keeps the heap of an
+ *    earlier run; the brk starts at 0 and the owner of the heap restores it
+ *    (see mm_restore). Nothing above the brk is assumed to be zero then.
+ *    Returns 0, or -1 if the file cannot be mapped at MEM_FILE_BASE.
+ */
+int mem_init_file(const char *path, int create)
+{
+    int fd;
+    char *base;
+
+    fd = open(path, create ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDWR, 0600);
+    if (fd < 0)
+	return -1;
+    if (create && ftruncate(fd, MAX_HEAP) < 0) {
+	close(fd);
+	return -1;
+    }
+    base = (char *)mmap((void *)MEM_FILE_BASE, MAX_HEAP, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == (char *)MAP_FAILED)
+	return -1;
+    if (base != (char *)MEM_FILE_BASE) {
+	munmap(base, MAX_HEAP);
+	errno = EADDRINUSE;
+	return -1;
+    }
+
+    mem_start_brk = base;
+    mem_size = MAX_HEAP;
+    mem_max_addr = mem_start_brk + MAX_HEAP;
+    mem_brk = mem_start_brk;
+    mem_clean_brk = create ? mem_start_brk : mem_max_addr;
+    return 0;
 }
 
 /* 
  * mem_deinit - free the storage used by the memory system model
+ *    (a file-backed heap is written back to its file)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    munmap(mem_start_brk, mem_size);
 }
 
 /*
@@ -53,7 +116,7 @@ void mem_reset_brk()
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
  *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    this model, the heap cannot be shrunk by mem_sbrk; see mem_trim.
  */
 void *mem_sbrk(int incr) 
 {
@@ -65,9 +128,26 @@ void *mem_sbrk(int incr)
 	return (void *)-1;
     }
     mem_brk += incr;
+    if (mem_brk > mem_clean_brk)
+	mem_clean_brk = mem_brk;
     return (void *)old_brk;
 }
 
+/*
+ * mem_trim - shrink the heap by decr bytes, as mm_compact and the mm
+ *    maintenance thread do, and return the new end of the heap
+ */
+void *mem_trim(size_t decr)
+{
+    if (decr > (size_t)(mem_brk - mem_start_brk)) {
+	errno = EINVAL;
+	fprintf(stderr, "ERROR: mem_trim failed. Heap is smaller than that...\n");
+	return (void *)-1;
+    }
+    mem_brk -= decr;
+    return (void *)mem_brk;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -84,6 +164,16 @@ void *mem_heap_hi()
     return (void *)(mem_brk - 1);
 }
 
+/*
+ * mem_clean_lo - return the lowest address that has never been handed out
+ *    by mem_sbrk since mem_init. Everything from there up is still zero,
+ *    even after mem_reset_brk.
+ */
+void *mem_clean_lo()
+{
+    return (void *)mem_clean_brk;
+}
+
 /*
  * mem_heapsize() - returns the heap size in bytes
  */
@@ -1,11 +1,15 @@
 #include <unistd.h>
 
 void mem_init(void);               
+int mem_init_size(size_t size);
+int mem_init_file(const char *path, int create);
 void mem_deinit(void);
 void *mem_sbrk(int incr);
+void *mem_trim(size_t decr);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
+void *mem_clean_lo(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
 
@@ -5,15 +5,48 @@
  * My allocated block consists of header and footer. 
  * Header and footer have same information about its block size and allocation.
  * In addition, my free block has addresses of predecessor and successor of free list.
- * Free list is single list and 'free_listp' always points to the first block of the list.
+ * Free blocks are kept in LIST segregated lists by power-of-two size class; 'free_lists[c]' points
+ * to the first block of class c.
+ * Each class also keeps a packed index: contiguous arrays of block sizes and heap offsets.
+ * find_fit scans the index (with SSE2/AVX2 compares when available) instead of chasing list
+ * pointers and loading a header per step. If a class has more free blocks than the index holds,
+ * it spills and find_fit walks that list until it empties. An indexed free block keeps its
+ * position in the index in the word after its list links, so delete() finds its entry in O(1).
+ * A free block whose header has the ZERO bit set has an all-zero payload apart from its list
+ * links, so mm_calloc only clears the links. Blocks made from fresh memlib memory start out zero.
+ * Blocks allocated through a handle have the MOVABLE bit set and keep a pointer back to their
+ * handle in their first word. mm_compact slides the unlocked ones down over the free blocks,
+ * repoints their handles and trims the heap.
+ * With MM_OPT_BACKGROUND a maintenance thread runs next to the caller. The entry points then
+ * hold a heap lock, and mm_free only pushes the block on a lock-free stack. The thread frees
+ * and coalesces those blocks, trims free space off the top of the heap and extends the heap
+ * before it runs low. MM_OPT_THREADS turns on the same heap lock without the thread, for callers
+ * on several threads. With MM_OPT_LINE_BLOCKS every block from malloc, calloc, memalign and realloc
+ * also gets a cache-line aligned payload and a size in whole cache lines, so the payloads of two
+ * blocks (handed to different threads, say) never share a line; only boundary tags do, and those
+ * are written under the lock. MM_OPT_MIN_ALIGN rounds every block size up to a larger power of
+ * two; the first payload of the heap sits on a 16-byte boundary, so with 16 every block found
+ * through the index or carved from a split already has a 16-aligned payload.
+ * Everything else the allocator keeps (list heads, class indexes) is outside the heap;
+ * mm_checkpoint saves it so that a file-backed heap can be mapped again and resumed by mm_restore.
+ * MM_OPT_CHECK runs cheaper checks than mm_check inside the entry points: the boundary tags
+ * and list links around each block an operation touches, plus a random slice of the heap
+ * every few operations or the full mm_check.
  * If I free a block, I immediately coalesce the previous and next free block if they exit.
  * 
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <limits.h>
 #include <unistd.h>
 #include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
@@ -25,6 +58,19 @@
 #define CHUNKSIZE (1<<12) 
 #define MINIMUM 24
 #define LIST 20
+#define INDEX_CAP 512   /* packed index entries per size class */
+#define REGION_CHUNK (1<<13)  /* default payload bytes per region chunk */
+#define REGION_BATCH 64       /* chunks handed to one mm_free_batch call */
+#define POOL_SLAB (1<<12)     /* minimum bytes per object pool slab */
+#define POOL_MIN_OBJS 8       /* objects per slab at least */
+#define HANDLE_CHUNK 128      /* handles taken from the heap at a time */
+#define DEFER_WAKE 64         /* deferred frees that wake the maintenance thread */
+#define MAINT_PERIOD 1000000  /* ns the maintenance thread sleeps at most */
+#define TRIM_KEEP (4*CHUNKSIZE)  /* free bytes the thread leaves at the top of the heap */
+#define LOW_WATER (2*CHUNKSIZE)  /* the thread extends the heap below this many free bytes */
+#define CKPT_MAGIC 0x6d6d636b    /* "mmck", first word of a checkpoint file */
+#define CACHE_LINE 64            /* line size MM_OPT_LINE_BLOCKS separates blocks by */
+#define CHECK_SLICE 32           /* blocks walked by one MM_CHECK_SAMPLE check */
 
 #define MAX(x,y) ((x) > (y)? (x) : (y))
 #define MIN(x,y) ((x) < (y)? (x) : (y))
@@ -35,6 +81,13 @@
 
 #define GET_SIZE(p) (GET(p) & ~0x7)
 #define GET_ALLOC(p) (GET(p) & 0x1)
+#define GET_ZERO(p) (GET(p) & ZERO)
+
+/* Free block header bit: payload is zero except for the list links */
+#define ZERO 0x2
+
+/* Allocated block header bit: handle block that mm_compact may move */
+#define MOVABLE 0x4
 
 #define HDRP(bp) ((char *)(bp) - WSIZE)
 #define FTRP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
@@ -50,6 +103,13 @@
 #define PRED(bp) (*(char **)(PRED_PTR(bp)))
 #define SUCC(bp) (*(char **)(SUCC_PTR(bp)))
 
+/* Address of free block's position in its class index, NO_SLOT if not indexed */
+#define SLOT_PTR(bp) ((char *)(bp) + DSIZE + sizeof(char *))
+#define NO_SLOT 0xffffffff
+
+/* Bytes at the start of a free block's payload that hold the list links and index slot */
+#define LINK_BYTES (DSIZE + sizeof(char *) + WSIZE)
+
 /* single word (4) or double word (8) alignment */
 #define ALIGNMENT 8
 
@@ -58,22 +118,153 @@
 
 
 #define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
+
+/* rounds a block size up to a multiple of block_align (see MM_OPT_MIN_ALIGN) */
+#define BLOCK_ROUND(size) (((size) + (block_align-1)) & ~(block_align-1))
+
+/* rounds up to a whole number of cache lines */
+#define LINE_ROUND(size) (((size) + (CACHE_LINE-1)) & ~(size_t)(CACHE_LINE-1))
 /* heap consistency checker */
 int mm_check(void);
 
 
 /* global variable */
 static char *heap_listp;
-static char *free_listp;
+static char *free_lists[LIST];
+
+/* packed free block index, one per size class (structure of arrays) */
+static unsigned int index_size[LIST][INDEX_CAP] __attribute__((aligned(32)));
+static unsigned int index_off[LIST][INDEX_CAP];
+static int index_count[LIST];
+static int index_spilled[LIST];
+
+/*
+ * A region is a list of chunks taken from the heap with mm_malloc. The first
+ * word of each chunk links to the previously taken chunk; allocation bumps
+ * 'cur' through the newest chunk.
+ */
+struct mm_region {
+    char *chunks;  /* newest chunk */
+    char *cur;     /* next free byte in the newest chunk */
+    char *end;     /* end of the newest chunk's payload */
+};
+
+/*
+ * An object pool hands out objects of one size from slabs taken with
+ * mm_memalign. Each slab is aligned to its own size, so the slab of an object is
+ * found by masking its address. The slab header keeps an intrusive stack of
+ * its free objects. Slabs with free objects are on the pool's partial list and
+ * full slabs on its full list, so allocation only looks at the partial head.
+ * A slab that becomes empty goes back to the heap unless it is the only
+ * partial slab.
+ */
+typedef struct pool_slab {
+    struct pool_slab *next;  /* next slab on the same list */
+    struct pool_slab *prev;  /* previous slab on the same list */
+    char *free;              /* stack of free objects, linked by their first word */
+    int used;                /* objects handed out */
+} pool_slab_t;
+
+struct mm_pool {
+    size_t objsize;          /* bytes per object */
+    size_t slab_size;        /* bytes (and alignment) per slab */
+    pool_slab_t *partial;    /* slabs with free objects */
+    pool_slab_t *full;       /* slabs without */
+};
+
+/*
+ * A handle points to its block, whose first word points back to the handle.
+ * Unused handles are stacked on 'handle_free', linked through 'bp'.
+ */
+struct mm_handle {
+    char *bp;   /* block of the handle */
+    int locks;  /* mm_hlock calls not yet undone; the block moves only at 0 */
+};
+
+static mm_handle_t *handle_free;
+
+/*
+ * Background maintenance state. heap_lock is recursive because entry points call
+ * each other, and it is only taken while 'threaded' is set: while the thread runs or
+ * 'mt_callers' asks for it. Deferred blocks stay marked allocated and are linked
+ * through their first payload word.
+ */
+static int threaded;
+static int mt_callers;
+static int maint_running;
+static pthread_t maint_thread;
+static pthread_mutex_t heap_lock;
+static pthread_cond_t maint_wake = PTHREAD_COND_INITIALIZER;
+static char *volatile deferred;
+static volatile int deferred_count;
+static size_t free_bytes;   /* bytes in all free blocks */
+
+/* Header of a checkpoint file; the free lists and class indexes follow it */
+typedef struct {
+    unsigned int magic;
+    char *heap_lo;            /* heap address the saved pointers are valid for */
+    size_t heap_size;
+    char *heap_listp;
+    mm_handle_t *handle_free;
+    size_t free_bytes;
+} ckpt_t;
+
+#define LOCK() do { if (threaded) pthread_mutex_lock(&heap_lock); } while (0)
+#define UNLOCK() do { if (threaded) pthread_mutex_unlock(&heap_lock); } while (0)
+
+/* tunables (see mm_setopt), kept across mm_init calls */
+static size_t place_split = MM_PLACE_SPLIT_DEFAULT;
+static int line_blocks;
+static size_t block_align = ALIGNMENT;
+static int check_tier;
+static size_t check_period = MM_CHECK_PERIOD_DEFAULT;
+
+/* MM_CHECK_SAMPLE state: ops since the last slice, and the slice position generator */
+static size_t check_ops;
+static unsigned int check_seed = 2463534242u;
+
+#define CHECK(bp) do { if (check_tier) check_op(bp); } while (0)
 
 
 /* helper functions */
 static void *extend_heap(size_t words);
 static void *coalesce(void *bp);
 static void *find_fit(size_t size);
-static void place(void *bp, size_t size);
+static void *place(void *bp, size_t size);
+static void *place_end(void *bp, size_t size, int high);
+static int high_end(size_t size, int life);
 static void insert(void *bp);
 static void delete(void *bp);
+static int class_of(size_t size);
+static int index_find(int c, size_t size);
+static void clear_seam(void *bp);
+static size_t align_gap(void *bp, size_t align);
+static void *find_aligned_fit(size_t size, size_t align);
+static void *place_aligned(void *bp, size_t size, size_t align);
+static void *aligned_block(size_t asize, size_t align);
+static void *line_block(size_t asize);
+static int addr_cmp(const void *a, const void *b);
+static void slab_push(pool_slab_t **list, pool_slab_t *slab);
+static void slab_unlink(pool_slab_t **list, pool_slab_t *slab);
+static mm_handle_t *handle_new(void);
+static void *malloc_block(size_t size, int life);
+static void *calloc_block(size_t nmemb, size_t size);
+static void *memalign_block(size_t align, size_t size);
+static void *realloc_block(void *ptr, size_t size);
+static void free_block(void *ptr);
+static void drain_deferred(void);
+static void trim_top(void);
+static void *maint_main(void *arg);
+static void lock_init(void);
+static void lock_make(void);
+static void fork_prepare(void);
+static void fork_parent(void);
+static void fork_child(void);
+static void check_block(void *bp);
+static void check_slice(void);
+static void check_op(void *bp);
+static int maint_start(void);
+static void maint_stop(void);
 
 /* mm_check implementation */
 int mm_check(void) 
@@ -82,38 +273,67 @@ int mm_check(void)
     char *ptr2;
     char *ptr3;
     char *ptr4;
-    ptr1 = free_listp;
-    ptr2 = free_listp;
-    ptr3 = heap_listp;
-    ptr4 = heap_listp;
-    /* 1. Check whether all free block in the free list are marked as free */
-    while (ptr1 != NULL) {
-        if (GET_ALLOC(HDRP(ptr1)) == 1) {
-            printf("Error: %p - Unmarked free block error \n", ptr1);
-            assert(0);
+    int c, i;
+    for (c = 0; c < LIST; c++) {
+        ptr1 = free_lists[c];
+        ptr2 = free_lists[c];
+        /* 1. Check whether all free block in the free list are marked as free and in the right class */
+        while (ptr1 != NULL) {
+            if (GET_ALLOC(HDRP(ptr1)) == 1) {
+                printf("Error: %p - Unmarked free block error \n", ptr1);
+                assert(0);
+            }
+            if (class_of(GET_SIZE(HDRP(ptr1))) != c) {
+                printf("Error: %p - Free block in the wrong size class \n", ptr1);
+                assert(0);
+            }
+            ptr1 = SUCC(ptr1);
         }
-        ptr1 = SUCC(ptr1);
-    }
 
-    /* 2. Check whether all free block are coalesced */
-    while (ptr2 != NULL) {
-        if (GET_ALLOC(HDRP(NEXT_BLKP(ptr2))) == 0 || GET_ALLOC(HDRP(PREV_BLKP(ptr2))) == 0) {
-            printf("Error: %p - Not coalesced free block error \n", ptr2);
-            assert(0);
+        /* 2. Check whether all free block are coalesced */
+        while (ptr2 != NULL) {
+            if (GET_ALLOC(HDRP(NEXT_BLKP(ptr2))) == 0 || GET_ALLOC(HDRP(PREV_BLKP(ptr2))) == 0) {
+                printf("Error: %p - Not coalesced free block error \n", ptr2);
+                assert(0);
+            }
+            ptr2 = SUCC(ptr2);
+        }
+
+        /* 5. Check whether every index entry describes a free block of that size */
+        for (i = 0; i < index_count[c]; i++) {
+            ptr1 = (char *)mem_heap_lo() + index_off[c][i];
+            if (GET_ALLOC(HDRP(ptr1)) || GET_SIZE(HDRP(ptr1)) != index_size[c][i]) {
+                printf("Error: %p - Stale free block index entry \n", ptr1);
+                assert(0);
+            }
+            if (GET(SLOT_PTR(ptr1)) != (unsigned int)i) {
+                printf("Error: %p - Free block has the wrong index slot \n", ptr1);
+                assert(0);
+            }
         }
-        ptr2 = SUCC(ptr2);
     }
 
     /* 3. Check whether all free block are in the list */
+    ptr3 = heap_listp;
     while (GET_SIZE(HDRP(ptr3)) != 0) {
-        if (!GET_ALLOC(HDRP(ptr3)) && (PRED(ptr3) == NULL) && (SUCC(ptr3) == NULL) && (free_listp != ptr3)) {
+        if (!GET_ALLOC(HDRP(ptr3)) && (PRED(ptr3) == NULL) && (SUCC(ptr3) == NULL) && (free_lists[class_of(GET_SIZE(HDRP(ptr3)))] != ptr3)) {
             printf("Error: %p - A free block is not included in the list \n", ptr3);
             assert(0);
         }
+        /* 6. Check whether free blocks marked zero really are zero past their links */
+        if (!GET_ALLOC(HDRP(ptr3)) && GET_ZERO(HDRP(ptr3))) {
+            for (ptr1 = ptr3 + LINK_BYTES; ptr1 < FTRP(ptr3); ptr1++) {
+                if (*ptr1 != 0) {
+                    printf("Error: %p - Free block marked zero is dirty at %p \n", ptr3, ptr1);
+                    assert(0);
+                }
+            }
+        }
         ptr3 = NEXT_BLKP(ptr3);
     }
 
     /* 4. Check whether all allocated blocks are not overlaped */
+    ptr4 = heap_listp;
     ptr4 = NEXT_BLKP(ptr4);
     while (GET_SIZE(HDRP(ptr4)) != 0) {
         if (GET_ALLOC(HDRP(PREV_BLKP(ptr4))) && GET_ALLOC(HDRP(ptr4))) {
@@ -134,17 +354,23 @@ int mm_check(void)
 static void *extend_heap(size_t words) 
 { 
     char *bp;
+    char *clean = mem_clean_lo();
     size_t size;
+    size_t zero;
 
-    /* ALlocate an even number of words to maintain alignmnent */
-    size = (words % 2) ? (words+1) * WSIZE : words * WSIZE;
+    /* ALlocate a multiple of block_align to maintain alignmnent */
+    if (words > INT_MAX / WSIZE - CACHE_LINE) /* mem_sbrk takes an int */
+        return NULL;
+    size = BLOCK_ROUND(words * WSIZE);
     bp = mem_sbrk(size);
     if ((long) bp == -1) 
         return NULL;
+    /* memory never handed out before is still zero */
+    zero = (bp >= clean) ? ZERO : 0;
     
     /* Initialize free block header/footer and the epilogue header */
-    PUT(HDRP(bp), PACK(size, 0));  /* Free block header */
-    PUT(FTRP(bp), PACK(size, 0)); /* Free block footer */
+    PUT(HDRP(bp), PACK(size, zero));  /* Free block header */
+    PUT(FTRP(bp), PACK(size, zero)); /* Free block footer */
     PUT(HDRP(NEXT_BLKP(bp)), PACK(0,1)); /* New epilogue header */
     
     /* insert the new free block to the free list */
@@ -154,11 +380,15 @@ static void *extend_heap(size_t words)
     return coalesce(bp);
 }
 // For given free block, if there exists prev or next free block,  coalesce with it and return the new free block pointer.
+// The result keeps the ZERO bit only if every merged block had it; the boundary tags and links
+// that end up inside the merged payload are then cleared.
 static void *coalesce(void *bp) 
 {
     size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
     size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
     size_t size = GET_SIZE(HDRP(bp));   
+    size_t zero = GET_ZERO(HDRP(bp));
+    char *next;
     
     /* Case 1: return the bp */
     if (prev_alloc && next_alloc) 
@@ -167,92 +397,237 @@ static void *coalesce(void *bp)
     delete(bp);
 
     if (prev_alloc && !next_alloc) { /* Case 2 : delete the next block and insert new  block */
-        delete(NEXT_BLKP(bp));
-        size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
-        PUT(HDRP(bp), PACK(size, 0));
+        next = NEXT_BLKP(bp);
+        delete(next);
+        size += GET_SIZE(HDRP(next));
+        zero &= GET_ZERO(HDRP(next));
+        if (zero)
+            clear_seam(next);
     }
     else if (!prev_alloc && next_alloc) { /* Case 3 : delete original free block from the list and insert new block */
+        delete(PREV_BLKP(bp)); /* before its header changes: delete() finds the class by size */
         size += GET_SIZE(HDRP(PREV_BLKP(bp)));
-        PUT(FTRP(bp), PACK(size, 0));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
+        zero &= GET_ZERO(HDRP(PREV_BLKP(bp)));
+        next = bp;
         bp = PREV_BLKP(bp);
-        delete(bp);
+        if (zero)
+            clear_seam(next);
     }
     else if (!prev_alloc && !next_alloc) { /* Case 4 : delete both of prev and next block  */
-        size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(HDRP(NEXT_BLKP(bp)));
-        PUT(FTRP(NEXT_BLKP(bp)), PACK(size,0));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size,0));
+        next = NEXT_BLKP(bp);
         delete(PREV_BLKP(bp));
-        delete(NEXT_BLKP(bp));
+        delete(next);
+        size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(HDRP(next));
+        zero &= GET_ZERO(HDRP(PREV_BLKP(bp))) & GET_ZERO(HDRP(next));
+        if (zero)
+            clear_seam(next);
+        next = bp;
         bp = PREV_BLKP(bp);
+        if (zero)
+            clear_seam(next);
     }
+    PUT(HDRP(bp), PACK(size, zero));
+    PUT(FTRP(bp), PACK(size, zero));
     insert(bp);
     return bp;
    
 }
 
-/* It gets a block size that it should allocate and returns a free block pointer */
+/* Clear the previous block's footer, the header and the links of bp, which a merge moves into a payload */
+static void clear_seam(void *bp) {
+    memset(HDRP(bp) - WSIZE, 0, DSIZE + LINK_BYTES);
+}
+
+/*
+ * It gets a block size that it should allocate and returns a free block pointer.
+ * Searches the size classes from the one of 'size' upward, scanning each packed index
+ * (or walking the list if the class has spilled out of its index).
+ */
 static void *find_fit(size_t size) {
     void *ptr;
-    ptr = free_listp;
+    int c, i;
 
-    while (ptr != NULL) {
-        if (GET_SIZE(HDRP(ptr)) >= size) {
-            return ptr;
+    for (c = class_of(size); c < LIST; c++) {
+        if (!index_spilled[c]) {
+            if ((i = index_find(c, size)) >= 0)
+                return (char *)mem_heap_lo() + index_off[c][i];
+            continue;
         }
-        ptr = SUCC(ptr);
-    } 
+        ptr = free_lists[c];
+        while (ptr != NULL) {
+            if (GET_SIZE(HDRP(ptr)) >= size) {
+                return ptr;
+            }
+            ptr = SUCC(ptr);
+        } 
+    }
 
+    /* Blocks waiting to be freed by the maintenance thread may fit */
+    if (deferred != NULL) {
+        drain_deferred();
+        return find_fit(size);
+    }
     return NULL;     
 }
 
-// With given free block to be alocated soon, place the size block on the bp address
-static void place(void *bp, size_t size) {
+/*
+ * With given free block to be alocated soon, place the size block in it and return the allocated block pointer.
+ * If the remainder is split off, small requests (below place_split) are carved from the high end
+ * of the free block and large ones from the low end, so small long-lived blocks collect together
+ * instead of being stranded between the holes left by large short-lived ones.
+ * place_split == 0 always splits from the low end.
+ */
+static void *place(void *bp, size_t size) {
+    return place_end(bp, size, high_end(size, MM_LIFE_DEFAULT));
+}
+
+/*
+ * Whether a block of size bytes with lifetime class life goes at the high end of its free
+ * block. Short-lived blocks do, long-lived ones do not, and the rest go by size (place_split).
+ * A fresh heap extension thus fills from both ends and the short-lived blocks free into one area.
+ */
+static int high_end(size_t size, int life) {
+    if (life == MM_LIFE_SHORT)
+        return 1;
+    if (life == MM_LIFE_LONG)
+        return 0;
+    return place_split && size < place_split;
+}
+
+/* place, with the end of the free block given by high */
+static void *place_end(void *bp, size_t size, int high) {
     size_t old_size = GET_SIZE(HDRP(bp));
+    size_t zero = GET_ZERO(HDRP(bp)); /* the remainder stays as clean as the block was */
 
     /* if original free block's remained size is bigger than MINIMUM */
     if ((old_size - size) >= MINIMUM) {
+        delete(bp);
+        if (high) { /* free remainder first, block at the high end */
+            PUT(HDRP(bp), PACK((old_size - size), zero));
+            PUT(FTRP(bp), PACK((old_size - size), zero));
+            insert(bp);
+            bp = NEXT_BLKP(bp);
+            PUT(HDRP(bp), PACK(size,1));
+            PUT(FTRP(bp), PACK(size,1));
+            return bp;
+        }
         PUT(HDRP(bp), PACK(size,1));
         PUT(FTRP(bp), PACK(size,1));
-        delete(bp);
-        bp = NEXT_BLKP(bp);
-        PUT(HDRP(bp), PACK((old_size - size), 0));
-        PUT(FTRP(bp), PACK((old_size - size), 0));
-        insert(bp);
+        PUT(HDRP(NEXT_BLKP(bp)), PACK((old_size - size), zero));
+        PUT(FTRP(NEXT_BLKP(bp)), PACK((old_size - size), zero));
+        insert(NEXT_BLKP(bp));
     } else {
         PUT(HDRP(bp), PACK(old_size, 1));
         PUT(FTRP(bp), PACK(old_size, 1));
         delete(bp);
     } 
+    return bp;
+}
+ 
+/* Bytes from bp to the first align-aligned payload address that leaves room for a free block before it */
+static size_t align_gap(void *bp, size_t align) {
+    size_t gap = (align - ((size_t)bp & (align - 1))) & (align - 1);
+
+    while (gap != 0 && gap < MINIMUM)
+        gap += align;
+    return gap;
+}
+
+/* Like find_fit, but the block must also hold size bytes at an align-aligned payload address */
+static void *find_aligned_fit(size_t size, size_t align) {
+    char *ptr;
+    int c;
+
+    for (c = class_of(size); c < LIST; c++) {
+        for (ptr = free_lists[c]; ptr != NULL; ptr = SUCC(ptr)) {
+            if (align_gap(ptr, align) + size <= GET_SIZE(HDRP(ptr)))
+                return ptr;
+        }
+    }
+    if (deferred != NULL) {
+        drain_deferred();
+        return find_aligned_fit(size, align);
+    }
+    return NULL;
+}
+
+/*
+ * Allocate size bytes from free block bp at its first align-aligned payload address.
+ * The leading gap and any trailing remainder of MINIMUM or more go back on the free lists.
+ * Both neighbours of bp are allocated, so neither piece needs coalescing.
+ */
+static void *place_aligned(void *bp, size_t size, size_t align) {
+    size_t old_size = GET_SIZE(HDRP(bp));
+    size_t zero = GET_ZERO(HDRP(bp));
+    size_t gap = align_gap(bp, align);
+
+    delete(bp);
+    if (gap) { /* the gap becomes a free block of its own */
+        PUT(HDRP(bp), PACK(gap, zero));
+        PUT(FTRP(bp), PACK(gap, zero));
+        insert(bp);
+        bp = NEXT_BLKP(bp);
+        old_size -= gap;
+    }
+    if ((old_size - size) >= MINIMUM) {
+        PUT(HDRP(bp), PACK(size,1));
+        PUT(FTRP(bp), PACK(size,1));
+        PUT(HDRP(NEXT_BLKP(bp)), PACK((old_size - size), zero));
+        PUT(FTRP(NEXT_BLKP(bp)), PACK((old_size - size), zero));
+        insert(NEXT_BLKP(bp));
+    } else {
+        PUT(HDRP(bp), PACK(old_size, 1));
+        PUT(FTRP(bp), PACK(old_size, 1));
+    }
+    return bp;
 }
  
-// Insert the free block to the free linked list 
+// Insert the free block to the free linked list of its size class and to the class index
 static void insert(void *bp) {
-    if (free_listp == NULL) {
+    size_t size = GET_SIZE(HDRP(bp));
+    int c = class_of(size);
+    char *head = free_lists[c];
+
+    free_bytes += size;
+
+    if (head == NULL) {
         PUT(PRED_PTR(bp), NULL);
         PUT(SUCC_PTR(bp), NULL);
-        free_listp = bp;
+        free_lists[c] = bp;
     } else {
         PUT(PRED_PTR(bp), NULL);
-        PUT(SUCC_PTR(bp), free_listp);
-        PUT(PRED_PTR(free_listp), bp);
-        free_listp = bp;
+        PUT(SUCC_PTR(bp), head);
+        PUT(PRED_PTR(head), bp);
+        free_lists[c] = bp;
+    }
+
+    if (index_count[c] < INDEX_CAP) {
+        index_size[c][index_count[c]] = size;
+        index_off[c][index_count[c]] = (char *)bp - (char *)mem_heap_lo();
+        PUT(SLOT_PTR(bp), index_count[c]);
+        index_count[c]++;
+    } else {
+        PUT(SLOT_PTR(bp), NO_SLOT);
+        index_spilled[c] = 1;
     }
 }
 
-// Delete the free block from the free linked list
+// Delete the free block from the free linked list and index of its size class
 static void delete(void *bp) {
     char *pred;
     char *succ;
+    int c = class_of(GET_SIZE(HDRP(bp)));
+    unsigned int i = GET(SLOT_PTR(bp));
+
+    free_bytes -= GET_SIZE(HDRP(bp));
     /* Get the predecessor and successor of bp */
     pred = PRED(bp);
     succ = SUCC(bp);
     /* Change the link of pred and succ */
     if (pred == NULL && succ == NULL) { /* if free list is empty */
-        free_listp = NULL;
+        free_lists[c] = NULL;
     } else if (pred == NULL) { /* if allocated free block is first entry of the list */
-        free_listp = succ;
+        free_lists[c] = succ;
         PUT(SUCC_PTR(bp), NULL);
         PUT(PRED_PTR(succ), NULL);
     } else if (succ == NULL) { /* if allocated block is last entry of the list */
@@ -264,7 +639,153 @@ static void delete(void *bp) {
         PUT(SUCC_PTR(bp), NULL);         
         PUT(PRED_PTR(bp), NULL);
     }    
-   
+
+    /* Swap the last index entry into its slot; a spilled class may not have indexed it */
+    if (i != NO_SLOT) {
+        index_count[c]--;
+        index_size[c][i] = index_size[c][index_count[c]];
+        index_off[c][i] = index_off[c][index_count[c]];
+        PUT(SLOT_PTR((char *)mem_heap_lo() + index_off[c][i]), i);
+    }
+    if (free_lists[c] == NULL)
+        index_spilled[c] = 0;
+}
+
+/* Size class of a block: class 0 holds blocks below 32 bytes, class c blocks in [2^(c+4), 2^(c+5)) */
+static int class_of(size_t size) {
+    int c = 0;
+
+    size >>= 5;
+    while (size > 0 && c < LIST - 1) {
+        size >>= 1;
+        c++;
+    }
+    return c;
+}
+
+/*
+ * Returns the position of the first entry in index c whose block is at least size bytes, or -1.
+ * The SIMD compares are signed. Indexed blocks are below 2^31 bytes (extend_heap never makes a
+ * bigger one), so they are safe for those, but a request can be bigger: it fits no block.
+ */
+static int index_find(int c, size_t size) {
+    unsigned int *sz = index_size[c];
+    int n = index_count[c];
+    int i = 0;
+
+    if (size > INT_MAX)
+        return -1;
+#if defined(__AVX2__)
+    __m256i want = _mm256_set1_epi32((int)size - 1);
+    int mask;
+
+    for (; i + 8 <= n; i += 8) {
+        mask = _mm256_movemask_ps(_mm256_castsi256_ps(
+            _mm256_cmpgt_epi32(_mm256_load_si256((__m256i *)(sz + i)), want)));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#elif defined(__SSE2__)
+    __m128i want = _mm_set1_epi32((int)size - 1);
+    int mask;
+
+    for (; i + 4 <= n; i += 4) {
+        mask = _mm_movemask_ps(_mm_castsi128_ps(
+            _mm_cmpgt_epi32(_mm_load_si128((__m128i *)(sz + i)), want)));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+    for (; i < n; i++) {
+        if (sz[i] >= size)
+            return i;
+    }
+    return -1;
+}
+
+/*
+ * check_block - Tier 0 check of block bp and its neighbours, O(1): header and footer agree
+ * on size and allocation, both neighbours' boundary tags agree, and every free one of the
+ * three is properly linked into its list.
+ */
+static void check_block(void *bp)
+{
+    char *nbrs[3];
+    char *p;
+    int i;
+
+    if ((char *)bp <= heap_listp || (char *)bp > (char *)mem_heap_hi()) {
+        printf("Error: %p - Block outside the heap \n", bp);
+        assert(0);
+    }
+    nbrs[0] = PREV_BLKP(bp);
+    nbrs[1] = bp;
+    nbrs[2] = NEXT_BLKP(bp);
+    for (i = 0; i < 3; i++) {
+        p = nbrs[i];
+        if (GET_SIZE(HDRP(p)) == 0) /* the epilogue has no footer */
+            continue;
+        if ((GET(HDRP(p)) & ~(size_t)(MOVABLE|ZERO)) != (GET(FTRP(p)) & ~(size_t)(MOVABLE|ZERO))) {
+            printf("Error: %p - Header and footer disagree \n", p);
+            assert(0);
+        }
+        if (GET_ALLOC(HDRP(p)))
+            continue;
+        if (PRED(p) == NULL ? free_lists[class_of(GET_SIZE(HDRP(p)))] != p : SUCC(PRED(p)) != p) {
+            printf("Error: %p - Broken free list link to the block \n", p);
+            assert(0);
+        }
+        if (SUCC(p) != NULL && PRED(SUCC(p)) != p) {
+            printf("Error: %p - Broken free list link from the block \n", p);
+            assert(0);
+        }
+    }
+}
+
+/*
+ * check_slice - Tier 1 check: run check_block on CHECK_SLICE blocks in a row, starting
+ * at a random free block from the class indexes (the first block if there is none),
+ * and check that no two of them are adjacent free blocks.
+ */
+static void check_slice(void)
+{
+    char *bp = NULL;
+    int c, i, n;
+
+    check_seed ^= check_seed << 13;
+    check_seed ^= check_seed >> 17;
+    check_seed ^= check_seed << 5;
+    for (n = 0; n < LIST && bp == NULL; n++) {
+        c = (check_seed + n) % LIST;
+        if (index_count[c] > 0)
+            bp = (char *)mem_heap_lo() + index_off[c][(check_seed >> 8) % index_count[c]];
+    }
+    if (bp == NULL)
+        bp = NEXT_BLKP(heap_listp);
+
+    for (i = 0; i < CHECK_SLICE && GET_SIZE(HDRP(bp)) != 0; i++, bp = NEXT_BLKP(bp)) {
+        check_block(bp);
+        if (!GET_ALLOC(HDRP(bp)) && !GET_ALLOC(HDRP(NEXT_BLKP(bp)))) {
+            printf("Error: %p - Not coalesced free block error \n", bp);
+            assert(0);
+        }
+    }
+}
+
+/*
+ * check_op - Run the checks of the current tier after an entry point touched bp.
+ * Called with the heap lock.
+ */
+static void check_op(void *bp)
+{
+    if (bp != NULL)
+        check_block(bp);
+    if (check_tier == MM_CHECK_SAMPLE && ++check_ops >= check_period) {
+        check_ops = 0;
+        check_slice();
+    }
+    if (check_tier == MM_CHECK_FULL)
+        mm_check();
 }
 /* End of helper function implementation */
 
@@ -274,7 +795,13 @@ static void delete(void *bp) {
 int mm_init(void)
 {   
     /* global variable initialization */
-    free_listp = NULL;
+    memset(free_lists, 0, sizeof(free_lists));
+    memset(index_count, 0, sizeof(index_count));
+    memset(index_spilled, 0, sizeof(index_spilled));
+    handle_free = NULL;
+    deferred = NULL;
+    deferred_count = 0;
+    free_bytes = 0;
   
     //printf("##########start###########\n");
     /* Create the initial empty heap */
@@ -295,7 +822,8 @@ int mm_init(void)
 }
 
 /* 
- * mm_malloc - Allocate a block by incrementing the brk pointer.
+ * malloc_block - Allocate a block by incrementing the brk pointer.
+ *     Where it goes inside its free block depends on lifetime class life.
  *     Always allocate a block whose size is a multiple of the alignment.
  * It computes the size of block that can contains header and footer.
  * By first fit seartch, it tries to find out free block for allocation.
@@ -304,7 +832,7 @@ int mm_init(void)
  * If there's no free block for this size, extend heap size by maximum of CHUNKSIZE and new block size.
  * And then do same mechanism as before.  
  */
-void *mm_malloc(size_t size)
+static void *malloc_block(size_t size, int life)
 {
     size_t asize; /* adjusted block size */ 
     size_t extendsize; /* Amount to extend heap if no fit */
@@ -312,14 +840,16 @@ void *mm_malloc(size_t size)
 
     if (size == 0) 
         return NULL;
+    if (line_blocks) /* whole cache lines, whatever the lifetime */
+        return line_block(LINE_ROUND(size+DSIZE));
  
     /* Adjust block size to include overhead and alignment reqs. */
-    asize = MAX(ALIGN(size+DSIZE), MINIMUM);
+    asize = BLOCK_ROUND(MAX(size+DSIZE, MINIMUM));
     //printf("malloc_sizse:	 [%d]\n", asize); 
     
     /* Search the free list for a fit */
     if ((bp = find_fit(asize)) !=NULL) {
-        place(bp, asize);
+        bp = place_end(bp, asize, high_end(asize, life));
         //mm_check();
         return bp;
     }
@@ -329,125 +859,440 @@ void *mm_malloc(size_t size)
     extendsize = MAX(asize, CHUNKSIZE);
     if ((bp = extend_heap(extendsize/WSIZE)) == NULL)
         return NULL;
-    place(bp, asize);
+    bp = place_end(bp, asize, high_end(asize, life));
     //mm_check();
     return bp;
         
 }
 
 /*
- * mm_free - Freeing a block does nothing.
- * It marks header and footer as free block and insert it to the free list. 
- * Then, coalesce with adjacent free blocks.
+ * mm_malloc - malloc_block under the heap lock
  */
-void mm_free(void *ptr)
+void *mm_malloc(size_t size)
 {
-    size_t size = GET_SIZE(HDRP(ptr));
-    //printf("free_size:	 [%d]\n", size); 
-    /* change the alloc bit to 0 */
-    PUT(HDRP(ptr), PACK(size,0));
-    PUT(FTRP(ptr), PACK(size,0));
-    /* insert freed block into the free list */
-    insert(ptr);
-    /* coalesce the freed block */
-    coalesce(ptr);
-   //  printf("free_listp address:  [%p]\n", (void *)free_listp);
-    //printf("free_listp footer address: [%p]\n", (void *)GET_SIZE(HDRP(free_listp)));
+    void *bp;
+
+    LOCK();
+    bp = malloc_block(size, MM_LIFE_DEFAULT);
+    CHECK(bp);
+    UNLOCK();
+    return bp;
 }
 
+/*
+ * mm_malloc_hint - mm_malloc for a block expected to live as long as lifetime class life
+ * (MM_LIFE_SHORT or MM_LIFE_LONG). The class only decides where in its free block the
+ * block goes, so a wrong hint costs space, never correctness.
+ */
+void *mm_malloc_hint(size_t size, int life)
+{
+    void *bp;
+
+    LOCK();
+    bp = malloc_block(size, life);
+    CHECK(bp);
+    UNLOCK();
+    return bp;
+}
 
 /*
- * mm_realloc - Implemented simply in terms of mm_malloc and mm_free
- * If ptr is NULL, it equals to mm_malloc.
- * If size is 0, it equals to mm_free.
- * Otherwise, check first whether orignal block size is enough to contain new block.
- * If then, allocate new block as original block place.
- * If not, then check whether next block is free.
- * If it is free and its size added to original block size is enough to allocate new one, allocate it.
- * If not, allocate at the new free block and copy the original block's payload to the new allocated one. 
+ * calloc_block - Allocate a zeroed block for nmemb elements of size bytes.
+ * Same fit and placement as mm_malloc. If the free block it comes from is marked ZERO,
+ * only its list links can be dirty, so just those bytes are cleared instead of the whole payload.
  */
-void *mm_realloc(void *ptr, size_t size)
+static void *calloc_block(size_t nmemb, size_t size)
 {
-    size_t asize;
-    size_t extendsize;
-    char *bp;  
-    size_t old_size;
-    size_t new_size = ALIGN(size+DSIZE);
-    size_t next_size;
-    size_t next_alloc;
-    if (ptr == NULL) { /* equivalent to mm_malloc */
-        if (size == 0) {
-            return NULL;
-        }  
-        /* Adjust block size to include overhead and alignment reqs. */
-        asize = MAX(ALIGN(size+DSIZE), MINIMUM);
-        //printf("malloc_sizse:      [%d]\n", asize); 
+    size_t asize; /* adjusted block size */ 
+    size_t extendsize; /* Amount to extend heap if no fit */
+    size_t zero;
+    size_t bytes;
+    char *bp; 
 
-        /* Search the free list for a fit */
-        if ((bp = find_fit(asize)) !=NULL) {
-            place(bp, asize);
-            return bp;
-        }  
+    if (nmemb == 0 || size == 0)
+        return NULL;
+    if (nmemb > (size_t)-1 / size) /* nmemb*size overflows */
+        return NULL;
+    bytes = nmemb * size;
+    if (line_blocks) { /* aligned placement does not track ZERO */
+        if ((bp = malloc_block(bytes, MM_LIFE_DEFAULT)) != NULL)
+            memset(bp, 0, bytes);
+        return bp;
+    }
 
+    /* Adjust block size to include overhead and alignment reqs. */
+    asize = BLOCK_ROUND(MAX(bytes+DSIZE, MINIMUM));
 
-        /* No fit found. Get more memory and place the block */
+    /* Search the free list for a fit, otherwise get more memory */
+    if ((bp = find_fit(asize)) == NULL) {
         extendsize = MAX(asize, CHUNKSIZE);
         if ((bp = extend_heap(extendsize/WSIZE)) == NULL)
             return NULL;
-        place(bp, asize);
-        return bp;
-
-    } else if (size == 0) { /* if size=0, then it's equivalent to mm_free */
-        /* change the alloc bit to 0 */
-        old_size = GET_SIZE(HDRP(ptr));
-        PUT(HDRP(ptr), PACK(old_size,0));
-        PUT(FTRP(ptr), PACK(old_size,0));
-        /* insert freed block into the free list */
-        insert(ptr);
-        /* coalesce the freed block */
-        coalesce(ptr);
-        
-    } else {
-       old_size = GET_SIZE(HDRP(ptr));   
-       if (new_size <= old_size) { /* if original block size is enough to allocate new block */
-           return ptr;
-       }
-       next_size = GET_SIZE(HDRP(NEXT_BLKP(ptr)));
-       next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(ptr)));
-       if (new_size <= old_size + next_size && !next_alloc) { /* if next block is free and the block size added to original' is enough to allocate new size, coalesce these blocks */
-           delete(NEXT_BLKP(ptr));
-           if (old_size + next_size - new_size >= MINIMUM) { /* if remained block size is bigger than MINIMUM */
-               PUT(HDRP(ptr), PACK(new_size, 1));
-               PUT(FTRP(ptr), PACK(new_size, 1));
-               PUT(HDRP(NEXT_BLKP(ptr)), PACK(old_size + next_size - new_size, 0));
-               PUT(FTRP(NEXT_BLKP(ptr)), PACK(old_size + next_size - new_size, 0));
-               insert(NEXT_BLKP(ptr));
-               return ptr;
-           } else  { /* if not, make internal fragmentation */
-               PUT(HDRP(ptr), PACK(old_size + next_size, 1));
-               PUT(FTRP(ptr), PACK(old_size + next_size, 1));
-               return ptr;
-           }
-       }         
-       /* allocate new block */
-  
-       /* Search the free list for a fit */
-       if ((bp = find_fit(new_size)) !=NULL) {
-           place(bp, new_size); 
-           memcpy(bp, ptr,old_size - DSIZE);
-           /* Free the original block */
-           PUT(HDRP(ptr), PACK(old_size,0));
-           PUT(FTRP(ptr), PACK(old_size,0));
-           insert(ptr);
-           coalesce(ptr);
-           return bp;
-       }
+    }
+    zero = GET_ZERO(HDRP(bp));
+    bp = place(bp, asize);
+
+    memset(bp, 0, zero ? MIN(LINK_BYTES, bytes) : bytes);
+    return bp;
+}
+
+/*
+ * mm_calloc - calloc_block under the heap lock
+ */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    void *bp;
+
+    LOCK();
+    bp = calloc_block(nmemb, size);
+    CHECK(bp);
+    UNLOCK();
+    return bp;
+}
+
+/*
+ * memalign_block - Allocate a block whose payload address is a multiple of align.
+ * align must be a power of two; up to MM_OPT_MIN_ALIGN it is the same as mm_malloc.
+ * It takes the first free block that can hold the payload at an aligned address and
+ * returns the leading gap to the free lists instead of wasting it. If none fits,
+ * the heap is extended by enough to guarantee an aligned fit.
+ */
+static void *memalign_block(size_t align, size_t size)
+{
+    if (size == 0 || align == 0 || (align & (align - 1)) != 0)
+        return NULL;
+    if (align <= block_align || (line_blocks && align <= CACHE_LINE))
+        return mm_malloc(size);
+    if (line_blocks)
+        return aligned_block(LINE_ROUND(size+DSIZE), align);
+ 
+    /* Adjust block size to include overhead and alignment reqs. */
+    return aligned_block(BLOCK_ROUND(MAX(size+DSIZE, MINIMUM)), align);
+}
+
+/*
+ * line_block - Allocate a block of asize bytes (whole cache lines) at a line-aligned payload.
+ * Blocks and the holes they leave are mostly whole lines already, so the packed index is
+ * asked for a fit that is aligned as it is, then for one big enough for any leading gap.
+ */
+static void *line_block(size_t asize)
+{
+    size_t extendsize; /* Amount to extend heap if no fit */
+    char *bp;
+
+    if ((bp = find_fit(asize)) != NULL && align_gap(bp, CACHE_LINE) != 0)
+        bp = find_fit(asize + CACHE_LINE + MINIMUM);
+    if (bp != NULL)
+        return place_aligned(bp, asize, CACHE_LINE);
+
+    extendsize = MAX(asize + CACHE_LINE + MINIMUM, CHUNKSIZE);
+    if ((bp = extend_heap(extendsize/WSIZE)) == NULL)
+        return NULL;
+    return place_aligned(bp, asize, CACHE_LINE);
+}
+
+/*
+ * aligned_block - Allocate a block of asize bytes whose payload address is a multiple of align.
+ */
+static void *aligned_block(size_t asize, size_t align)
+{
+    size_t extendsize; /* Amount to extend heap if no fit */
+    char *bp; 
+
+    /* Search the free list for a fit that can be aligned */
+    if ((bp = find_aligned_fit(asize, align)) != NULL)
+        return place_aligned(bp, asize, align);
+
+    /* No fit found. Get enough memory for any gap and place the block */
+    extendsize = MAX(asize + align + MINIMUM, CHUNKSIZE);
+    if ((bp = extend_heap(extendsize/WSIZE)) == NULL)
+        return NULL;
+    return place_aligned(bp, asize, align);
+}
+
+/*
+ * mm_memalign - memalign_block under the heap lock
+ */
+void *mm_memalign(size_t align, size_t size)
+{
+    void *bp;
+
+    LOCK();
+    bp = memalign_block(align, size);
+    CHECK(bp);
+    UNLOCK();
+    return bp;
+}
+
+/*
+ * mm_malloc_batch - Allocate n blocks of size bytes and store them in out[0..n-1].
+ * All n blocks are carved back to back from one free block (or one heap extension)
+ * that fits them together, so the free lists are touched once instead of n times.
+ * If no such block can be had, falls back to one mm_malloc per block.
+ * Returns the number of blocks allocated, 0 if the n blocks together could not fit
+ * in one heap extension (mem_sbrk takes an int).
+ */
+int mm_malloc_batch(size_t size, int n, void **out)
+{
+    size_t asize; /* adjusted block size */ 
+    size_t total; /* block bytes for all n */
+    size_t extendsize; /* Amount to extend heap if no fit */
+    size_t old_size;
+    size_t bsize;
+    size_t zero;
+    char *bp; 
+    int i;
+
+    if (size == 0 || n <= 0 || size > INT_MAX)
+        return 0;
+
+    /* Adjust block size to include overhead and alignment reqs. */
+    asize = BLOCK_ROUND(MAX(size+DSIZE, MINIMUM));
+    if ((size_t)n > INT_MAX / asize)
+        return 0;
+    total = asize * n;
+    LOCK();
+
+    /* Search the free list for a fit for all n, or get more memory */
+    if ((bp = find_fit(total)) == NULL) {
+        extendsize = MAX(total, CHUNKSIZE);
+        if ((bp = extend_heap(extendsize/WSIZE)) == NULL) {
+            for (i = 0; i < n; i++) {
+                if ((out[i] = mm_malloc(size)) == NULL)
+                    break;
+            }
+            UNLOCK();
+            return i;
+        }
+    }
+    old_size = GET_SIZE(HDRP(bp));
+    zero = GET_ZERO(HDRP(bp));
+    delete(bp);
+
+    /* Carve the blocks from the low end; the last one absorbs a remainder below MINIMUM */
+    if (old_size - total < MINIMUM)
+        total = old_size;
+    for (i = 0; i < n; i++) {
+        bsize = (i == n - 1) ? total - (n - 1) * asize : asize;
+        PUT(HDRP(bp), PACK(bsize, 1));
+        PUT(FTRP(bp), PACK(bsize, 1));
+        out[i] = bp;
+        bp = NEXT_BLKP(bp);
+    }
+    if (old_size > total) {
+        PUT(HDRP(bp), PACK(old_size - total, zero));
+        PUT(FTRP(bp), PACK(old_size - total, zero));
+        insert(bp);
+    }
+    for (i = 0; i < n; i++)
+        CHECK(out[i]);
+    UNLOCK();
+    return n;
+}
+
+/*
+ * mm_free_batch - Free the n blocks in ptrs (which is sorted in place).
+ * After sorting by address, each run of blocks that are adjacent in the heap is
+ * turned into one free block and coalesced with its neighbours once. Each block gets
+ * the checks mm_free gives it, but the frees are never deferred to the maintenance
+ * thread: the batch takes the heap lock once for all n, which is what deferring saves.
+ */
+void mm_free_batch(void **ptrs, int n)
+{
+    char *bp;
+    size_t size;
+    int i, j;
+
+    qsort(ptrs, n, sizeof(void *), addr_cmp);
+    LOCK();
+    for (i = 0; i < n; i++)
+        CHECK(ptrs[i]);
+    for (i = 0; i < n; i = j) {
+        bp = ptrs[i];
+        size = GET_SIZE(HDRP(bp));
+        for (j = i + 1; j < n && (char *)ptrs[j] == bp + size; j++)
+            size += GET_SIZE(HDRP(ptrs[j]));
+        PUT(HDRP(bp), PACK(size,0));
+        PUT(FTRP(bp), PACK(size,0));
+        insert(bp);
+        coalesce(bp);
+    }
+    UNLOCK();
+}
+
+/* qsort comparator that orders block pointers by address */
+static int addr_cmp(const void *a, const void *b)
+{
+    char *x = *(char * const *)a;
+    char *y = *(char * const *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * mm_free - Free a block under the heap lock. While the maintenance thread runs, the block is only pushed
+ * on the deferred stack (an O(1) compare-and-swap, no lock) for the thread to free.
+ */
+void mm_free(void *ptr)
+{
+    char *head;
+
+    if (!maint_running) {
+        LOCK();
+        CHECK(ptr);
+        free_block(ptr);
+        UNLOCK();
+        return;
+    }
+    do {
+        head = deferred;
+        *(char **)ptr = head;
+    } while (!__sync_bool_compare_and_swap(&deferred, head, (char *)ptr));
+    if (__sync_add_and_fetch(&deferred_count, 1) >= DEFER_WAKE)
+        pthread_cond_signal(&maint_wake);
+}
+
+/*
+ * free_block - Freeing a block does nothing.
+ * It marks header and footer as free block and insert it to the free list. 
+ * Then, coalesce with adjacent free blocks.
+ */
+static void free_block(void *ptr)
+{
+    size_t size = GET_SIZE(HDRP(ptr));
+    //printf("free_size:	 [%d]\n", size); 
+    /* change the alloc bit to 0 */
+    PUT(HDRP(ptr), PACK(size,0));
+    PUT(FTRP(ptr), PACK(size,0));
+    /* insert freed block into the free list */
+    insert(ptr);
+    /* coalesce the freed block */
+    coalesce(ptr);
+}
+
+/*
+ * mm_free_sized - Free a block the caller knows was allocated with size bytes.
+ * A block can be bigger than size implies (a split remainder below MINIMUM,
+ * in-place realloc growth), so the header stays the source of truth for the
+ * boundary tags; with assertions enabled the caller's size is checked against it.
+ */
+void mm_free_sized(void *ptr, size_t size)
+{
+    assert(GET_ALLOC(HDRP(ptr)));
+    assert(size <= mm_usable_size(ptr));
+    mm_free(ptr);
+}
+
+/*
+ * mm_usable_size - Return the number of payload bytes the block at ptr can hold,
+ * which is at least the size it was allocated with.
+ */
+size_t mm_usable_size(void *ptr)
+{
+    if (ptr == NULL)
+        return 0;
+    return GET_SIZE(HDRP(ptr)) - DSIZE;
+}
+
+/*
+ * realloc_block - Implemented simply in terms of mm_malloc and mm_free
+ * If ptr is NULL, it equals to mm_malloc.
+ * If size is 0, it equals to mm_free.
+ * Otherwise, check first whether orignal block size is enough to contain new block.
+ * If then, allocate new block as original block place.
+ * If not, then check whether next block is free.
+ * If it is free and its size added to original block size is enough to allocate new one, allocate it.
+ * If not, allocate at the new free block and copy the original block's payload to the new allocated one. 
+ */
+static void *realloc_block(void *ptr, size_t size)
+{
+    size_t asize;
+    size_t extendsize;
+    char *bp;  
+    size_t old_size;
+    size_t new_size = line_blocks ? LINE_ROUND(size+DSIZE) : BLOCK_ROUND(size+DSIZE);
+    size_t next_size;
+    size_t next_alloc;
+    if (ptr == NULL) { /* equivalent to mm_malloc */
+        if (size == 0) {
+            return NULL;
+        }  
+        if (line_blocks)
+            return malloc_block(size, MM_LIFE_DEFAULT);
+        /* Adjust block size to include overhead and alignment reqs. */
+        asize = BLOCK_ROUND(MAX(size+DSIZE, MINIMUM));
+        //printf("malloc_sizse:      [%d]\n", asize); 
+
+        /* Search the free list for a fit */
+        if ((bp = find_fit(asize)) !=NULL) {
+            return place(bp, asize);
+        }  
+
+
+        /* No fit found. Get more memory and place the block */
+        extendsize = MAX(asize, CHUNKSIZE);
+        if ((bp = extend_heap(extendsize/WSIZE)) == NULL)
+            return NULL;
+        return place(bp, asize);
+
+    } else if (size == 0) { /* if size=0, then it's equivalent to mm_free */
+        /* change the alloc bit to 0 */
+        old_size = GET_SIZE(HDRP(ptr));
+        PUT(HDRP(ptr), PACK(old_size,0));
+        PUT(FTRP(ptr), PACK(old_size,0));
+        /* insert freed block into the free list */
+        insert(ptr);
+        /* coalesce the freed block */
+        coalesce(ptr);
+        return NULL;
+        
+    } else {
+       old_size = GET_SIZE(HDRP(ptr));   
+       if (new_size <= old_size) { /* if original block size is enough to allocate new block */
+           return ptr;
+       }
+       next_size = GET_SIZE(HDRP(NEXT_BLKP(ptr)));
+       next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(ptr)));
+       if (new_size <= old_size + next_size && !next_alloc) { /* if next block is free and the block size added to original' is enough to allocate new size, coalesce these blocks */
+           delete(NEXT_BLKP(ptr));
+           if (old_size + next_size - new_size >= MINIMUM) { /* if remained block size is bigger than MINIMUM */
+               PUT(HDRP(ptr), PACK(new_size, 1));
+               PUT(FTRP(ptr), PACK(new_size, 1));
+               PUT(HDRP(NEXT_BLKP(ptr)), PACK(old_size + next_size - new_size, 0));
+               PUT(FTRP(NEXT_BLKP(ptr)), PACK(old_size + next_size - new_size, 0));
+               insert(NEXT_BLKP(ptr));
+               return ptr;
+           } else  { /* if not, make internal fragmentation */
+               PUT(HDRP(ptr), PACK(old_size + next_size, 1));
+               PUT(FTRP(ptr), PACK(old_size + next_size, 1));
+               return ptr;
+           }
+       }         
+       /* allocate new block */
+       if (line_blocks) {
+           if ((bp = malloc_block(size, MM_LIFE_DEFAULT)) == NULL)
+               return NULL;
+           memcpy(bp, ptr, old_size - DSIZE);
+           free_block(ptr);
+           return bp;
+       }
+  
+       /* Search the free list for a fit */
+       if ((bp = find_fit(new_size)) !=NULL) {
+           bp = place(bp, new_size); 
+           memcpy(bp, ptr,old_size - DSIZE);
+           /* Free the original block */
+           PUT(HDRP(ptr), PACK(old_size,0));
+           PUT(FTRP(ptr), PACK(old_size,0));
+           insert(ptr);
+           coalesce(ptr);
+           return bp;
+       }
 
        /* No fit found. Get more memory and place the block */
        extendsize = MAX(new_size, CHUNKSIZE);
        if ((bp = extend_heap(extendsize/WSIZE)) == NULL)
            return NULL;
-       place(bp, new_size);
+       bp = place(bp, new_size);
        memcpy(bp, ptr, old_size - DSIZE);
        /* free the original block */
        PUT(HDRP(ptr), PACK(old_size,0));
@@ -460,3 +1305,671 @@ void *mm_realloc(void *ptr, size_t size)
     }
 }
 
+/*
+ * mm_realloc - realloc_block under the heap lock
+ */
+void *mm_realloc(void *ptr, size_t size)
+{
+    void *bp;
+
+    LOCK();
+    bp = realloc_block(ptr, size);
+    CHECK(bp);
+    UNLOCK();
+    return bp;
+}
+
+/*
+ * mm_setopt - Set a tunable of the malloc package.
+ * Returns 0 on success, -1 for an unknown option (or if the thread cannot start).
+ */
+int mm_setopt(int opt, size_t val)
+{
+    switch (opt) {
+    case MM_OPT_PLACE_SPLIT:
+        place_split = val;
+        return 0;
+    case MM_OPT_BACKGROUND:
+        if (val)
+            return maint_start();
+        maint_stop();
+        return 0;
+    case MM_OPT_THREADS:
+        lock_init();
+        mt_callers = (val != 0);
+        threaded = mt_callers || maint_running;
+        return 0;
+    case MM_OPT_LINE_BLOCKS:
+        line_blocks = (val != 0);
+        return 0;
+    case MM_OPT_MIN_ALIGN:
+        if (val != ALIGNMENT && val != 2*ALIGNMENT)
+            return -1;
+        block_align = val;
+        return 0;
+    case MM_OPT_CHECK:
+        if (val > MM_CHECK_FULL)
+            return -1;
+        check_tier = val;
+        check_ops = 0;
+        return 0;
+    case MM_OPT_CHECK_PERIOD:
+        check_period = MAX(val, 1);
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+/*
+ * mm_region_create - Make an empty region. Its chunks, and the region itself,
+ * live in the heap, so a region does not survive mm_init.
+ */
+mm_region_t *mm_region_create(void)
+{
+    mm_region_t *r;
+
+    if ((r = mm_malloc(sizeof(mm_region_t))) == NULL)
+        return NULL;
+    r->chunks = NULL;
+    r->cur = r->end = NULL;
+    return r;
+}
+
+/*
+ * mm_region_alloc - Bump-allocate size bytes from region r, taking a new chunk
+ * from the heap when the current one is full. The block cannot be freed on
+ * its own; it goes away with the next mm_region_reset.
+ */
+void *mm_region_alloc(mm_region_t *r, size_t size)
+{
+    char *chunk;
+    char *bp;
+
+    size = ALIGN(size);
+    if (size == 0)
+        return NULL;
+    if (size > (size_t)(r->end - r->cur)) {
+        if ((chunk = mm_malloc(MAX(size, REGION_CHUNK) + SIZE_T_SIZE)) == NULL)
+            return NULL;
+        *(char **)chunk = r->chunks;
+        r->chunks = chunk;
+        r->cur = chunk + SIZE_T_SIZE;
+        r->end = chunk + mm_usable_size(chunk);
+    }
+    bp = r->cur;
+    r->cur += size;
+    return bp;
+}
+
+/*
+ * mm_region_reset - Release every block of region r at once. All chunks go
+ * back to the heap through mm_free_batch, which coalesces neighbouring chunks
+ * in a single pass.
+ */
+void mm_region_reset(mm_region_t *r)
+{
+    void *batch[REGION_BATCH];
+    char *chunk = r->chunks;
+    int n = 0;
+
+    while (chunk != NULL) {
+        batch[n++] = chunk;
+        chunk = *(char **)chunk;
+        if (n == REGION_BATCH) {
+            mm_free_batch(batch, n);
+            n = 0;
+        }
+    }
+    if (n > 0)
+        mm_free_batch(batch, n);
+    r->chunks = NULL;
+    r->cur = r->end = NULL;
+}
+
+/*
+ * mm_region_destroy - Reset region r and free the region itself
+ */
+void mm_region_destroy(mm_region_t *r)
+{
+    mm_region_reset(r);
+    mm_free(r);
+}
+
+/*
+ * mm_pool_create - Make an empty pool of objects of objsize bytes. Like
+ * regions, pools live in the heap and do not survive mm_init.
+ */
+mm_pool_t *mm_pool_create(size_t objsize)
+{
+    mm_pool_t *pool;
+
+    if (objsize == 0)
+        return NULL;
+    if ((pool = mm_malloc(sizeof(mm_pool_t))) == NULL)
+        return NULL;
+    pool->objsize = ALIGN(MAX(objsize, sizeof(char *)));
+    pool->slab_size = POOL_SLAB;
+    while (pool->slab_size - ALIGN(sizeof(pool_slab_t)) < POOL_MIN_OBJS * pool->objsize)
+        pool->slab_size <<= 1;
+    pool->partial = NULL;
+    pool->full = NULL;
+    return pool;
+}
+
+/* Push slab on the front of the list at *list */
+static void slab_push(pool_slab_t **list, pool_slab_t *slab)
+{
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list != NULL)
+        (*list)->prev = slab;
+    *list = slab;
+}
+
+/* Unlink slab from the list at *list */
+static void slab_unlink(pool_slab_t **list, pool_slab_t *slab)
+{
+    if (slab->prev != NULL)
+        slab->prev->next = slab->next;
+    else
+        *list = slab->next;
+    if (slab->next != NULL)
+        slab->next->prev = slab->prev;
+}
+
+/*
+ * mm_pool_alloc - Pop an object off the first partial slab, taking a new slab
+ * from the heap when every slab is full.
+ */
+void *mm_pool_alloc(mm_pool_t *pool)
+{
+    pool_slab_t *slab = pool->partial;
+    char *obj;
+    char *p;
+
+    if (slab == NULL) {
+        if ((slab = mm_memalign(pool->slab_size, pool->slab_size)) == NULL)
+            return NULL;
+        slab->free = NULL;
+        slab->used = 0;
+        for (p = (char *)slab + pool->slab_size - pool->objsize;
+             p >= (char *)slab + ALIGN(sizeof(pool_slab_t)); p -= pool->objsize) {
+            *(char **)p = slab->free;
+            slab->free = p;
+        }
+        slab_push(&pool->partial, slab);
+    }
+
+    obj = slab->free;
+    slab->free = *(char **)obj;
+    slab->used++;
+    if (slab->free == NULL) {
+        slab_unlink(&pool->partial, slab);
+        slab_push(&pool->full, slab);
+    }
+    return obj;
+}
+
+/*
+ * mm_pool_free - Push obj back on its slab. A slab that was full becomes
+ * partial again; a slab that is now empty is returned to the heap if another
+ * slab still has free objects.
+ */
+void mm_pool_free(mm_pool_t *pool, void *obj)
+{
+    pool_slab_t *slab = (pool_slab_t *)((size_t)obj & ~(pool->slab_size - 1));
+
+    if (slab->free == NULL) {
+        slab_unlink(&pool->full, slab);
+        slab_push(&pool->partial, slab);
+    }
+    *(char **)obj = slab->free;
+    slab->free = obj;
+    slab->used--;
+
+    if (slab->used == 0 && (slab->prev != NULL || slab->next != NULL)) {
+        slab_unlink(&pool->partial, slab);
+        mm_free(slab);
+    }
+}
+
+/*
+ * mm_pool_destroy - Return every slab of the pool, and the pool itself, to the heap
+ */
+void mm_pool_destroy(mm_pool_t *pool)
+{
+    pool_slab_t *slab;
+    pool_slab_t *next;
+
+    for (slab = pool->partial; slab != NULL; slab = next) {
+        next = slab->next;
+        mm_free(slab);
+    }
+    for (slab = pool->full; slab != NULL; slab = next) {
+        next = slab->next;
+        mm_free(slab);
+    }
+    mm_free(pool);
+}
+
+/*
+ * handle_new - Pop an unused handle, taking HANDLE_CHUNK more from the heap
+ * if there are none. Handles are never moved or given back before mm_init.
+ * Called with the heap lock held, like every change to 'handle_free'.
+ */
+static mm_handle_t *handle_new(void)
+{
+    mm_handle_t *chunk;
+    mm_handle_t *h;
+    int i;
+
+    if (handle_free == NULL) {
+        if ((chunk = mm_malloc(HANDLE_CHUNK * sizeof(mm_handle_t))) == NULL)
+            return NULL;
+        for (i = 0; i < HANDLE_CHUNK; i++) {
+            chunk[i].bp = (char *)handle_free;
+            handle_free = &chunk[i];
+        }
+    }
+    h = handle_free;
+    handle_free = (mm_handle_t *)h->bp;
+    return h;
+}
+
+/*
+ * mm_halloc - Allocate a movable block of size bytes. The payload is reached
+ * with mm_hlock and may move in mm_compact while the handle is unlocked.
+ */
+mm_handle_t *mm_halloc(size_t size)
+{
+    mm_handle_t *h;
+    char *bp;
+
+    if (size == 0)
+        return NULL;
+    LOCK();
+    if ((h = handle_new()) == NULL) {
+        UNLOCK();
+        return NULL;
+    }
+    if ((bp = mm_malloc(size + SIZE_T_SIZE)) == NULL) {
+        h->bp = (char *)handle_free;
+        handle_free = h;
+        UNLOCK();
+        return NULL;
+    }
+    PUT(HDRP(bp), GET(HDRP(bp)) | MOVABLE);
+    *(mm_handle_t **)bp = h;
+    h->bp = bp;
+    h->locks = 0;
+    UNLOCK();
+    return h;
+}
+
+/*
+ * mm_hrealloc - Resize the block of unlocked handle h to size bytes, keeping
+ * the handle. Returns 0, or -1 if out of memory (the old block stays).
+ */
+int mm_hrealloc(mm_handle_t *h, size_t size)
+{
+    char *bp;
+
+    LOCK();
+    assert(h->locks == 0);
+    if ((bp = mm_realloc(h->bp, size + SIZE_T_SIZE)) == NULL) {
+        UNLOCK();
+        return -1;
+    }
+    PUT(HDRP(bp), GET(HDRP(bp)) | MOVABLE);
+    h->bp = bp;
+    UNLOCK();
+    return 0;
+}
+
+/*
+ * mm_hfree - Free the block of unlocked handle h, and the handle itself
+ */
+void mm_hfree(mm_handle_t *h)
+{
+    LOCK();
+    assert(h->locks == 0);
+    mm_free(h->bp);
+    h->bp = (char *)handle_free;
+    handle_free = h;
+    UNLOCK();
+}
+
+/*
+ * mm_hlock - Pin the block of h and return its payload, which stays put until
+ * the matching mm_hunlock. Locks nest. The count changes under the heap lock,
+ * so mm_compact never moves a block between its test and the pin.
+ */
+void *mm_hlock(mm_handle_t *h)
+{
+    char *bp;
+
+    LOCK();
+    h->locks++;
+    bp = h->bp + SIZE_T_SIZE;
+    UNLOCK();
+    return bp;
+}
+
+/*
+ * mm_hunlock - Undo one mm_hlock of h
+ */
+void mm_hunlock(mm_handle_t *h)
+{
+    LOCK();
+    assert(h->locks > 0);
+    h->locks--;
+    UNLOCK();
+}
+
+/*
+ * mm_compact - Slide every unlocked handle block down over the free blocks
+ * below it, in one pass from the bottom of the heap. Other allocated blocks
+ * stay where they are; the free space left in front of each one becomes a
+ * single free block. Free space at the top is given back to memlib.
+ * Returns the number of bytes the heap shrank by.
+ */
+size_t mm_compact(void)
+{
+    char *bp;
+    char *next;
+    char *dest = NULL;  /* where the next movable block goes, NULL if no free space */
+    mm_handle_t *h;
+    size_t size;
+    size_t trimmed = 0;
+
+    /* Deferred blocks may belong to handles that were already reused; wait for the thread's too */
+    LOCK();
+    while (deferred_count > 0) {
+        if (deferred != NULL) {
+            drain_deferred();
+        } else {
+            UNLOCK();
+            sched_yield();
+            LOCK();
+        }
+    }
+
+    /* Every free block is rebuilt, so start with empty lists */
+    memset(free_lists, 0, sizeof(free_lists));
+    memset(index_count, 0, sizeof(index_count));
+    memset(index_spilled, 0, sizeof(index_spilled));
+    free_bytes = 0;
+
+    for (bp = NEXT_BLKP(heap_listp); (size = GET_SIZE(HDRP(bp))) != 0; bp = next) {
+        next = bp + size;
+        if (!GET_ALLOC(HDRP(bp))) {
+            if (dest == NULL)
+                dest = bp;
+        } else if ((GET(HDRP(bp)) & MOVABLE) && (h = *(mm_handle_t **)bp)->locks == 0) {
+            if (dest != NULL) {
+                memmove(HDRP(dest), HDRP(bp), size);
+                h->bp = dest;
+                dest += size;
+            }
+        } else if (dest != NULL) { /* pinned block: free everything in front of it */
+            PUT(HDRP(dest), PACK(bp - dest, 0));
+            PUT(FTRP(dest), PACK(bp - dest, 0));
+            insert(dest);
+            dest = NULL;
+        }
+    }
+
+    /* bp is the epilogue: move it down to dest */
+    if (dest != NULL) {
+        trimmed = bp - dest;
+        mem_trim(trimmed);
+        PUT(HDRP(dest), PACK(0, 1));
+    }
+    UNLOCK();
+    return trimmed;
+}
+
+/*
+ * mm_checkpoint - Save the allocator metadata (heap size, free list heads, class
+ * indexes, unused handles) to the file at path. The heap itself is not written: it
+ * should be file-backed (mem_init_file) so that it survives next to the checkpoint.
+ * The maintenance thread must be stopped. Returns 0, or -1 on an I/O error.
+ */
+int mm_checkpoint(const char *path)
+{
+    FILE *fp;
+    ckpt_t ck;
+    int ok = 1;
+
+    assert(!maint_running);
+    if (deferred != NULL)
+        drain_deferred();
+    if ((fp = fopen(path, "wb")) == NULL)
+        return -1;
+    ck.magic = CKPT_MAGIC;
+    ck.heap_lo = mem_heap_lo();
+    ck.heap_size = mem_heapsize();
+    ck.heap_listp = heap_listp;
+    ck.handle_free = handle_free;
+    ck.free_bytes = free_bytes;
+    ok &= fwrite(&ck, sizeof(ck), 1, fp) == 1;
+    ok &= fwrite(free_lists, sizeof(free_lists), 1, fp) == 1;
+    ok &= fwrite(index_count, sizeof(index_count), 1, fp) == 1;
+    ok &= fwrite(index_spilled, sizeof(index_spilled), 1, fp) == 1;
+    ok &= fwrite(index_size, sizeof(index_size), 1, fp) == 1;
+    ok &= fwrite(index_off, sizeof(index_off), 1, fp) == 1;
+    ok &= fclose(fp) == 0;
+    return ok ? 0 : -1;
+}
+
+/*
+ * mm_restore - Continue from a heap saved with mm_checkpoint. Instead of mm_init:
+ * memlib must already hold the saved heap at the same address (mem_init_file without
+ * create), and the brk is moved back up to the saved heap size.
+ * Returns 0, or -1 if the file is unreadable or belongs to a heap elsewhere; the
+ * allocator then needs mm_init.
+ */
+int mm_restore(const char *path)
+{
+    FILE *fp;
+    ckpt_t ck;
+    int ok = 1;
+
+    if ((fp = fopen(path, "rb")) == NULL)
+        return -1;
+    ok &= fread(&ck, sizeof(ck), 1, fp) == 1;
+    ok = ok && ck.magic == CKPT_MAGIC && ck.heap_lo == (char *)mem_heap_lo();
+    ok = ok && fread(free_lists, sizeof(free_lists), 1, fp) == 1;
+    ok = ok && fread(index_count, sizeof(index_count), 1, fp) == 1;
+    ok = ok && fread(index_spilled, sizeof(index_spilled), 1, fp) == 1;
+    ok = ok && fread(index_size, sizeof(index_size), 1, fp) == 1;
+    ok = ok && fread(index_off, sizeof(index_off), 1, fp) == 1;
+    fclose(fp);
+    if (!ok)
+        return -1;
+
+    mem_reset_brk();
+    if (mem_sbrk(ck.heap_size) == (void *)-1)
+        return -1;
+    heap_listp = ck.heap_listp;
+    handle_free = ck.handle_free;
+    free_bytes = ck.free_bytes;
+    deferred = NULL;
+    deferred_count = 0;
+    return 0;
+}
+
+/*
+ * drain_deferred - Free every block on the deferred stack. Called with the heap lock.
+ */
+static void drain_deferred(void)
+{
+    char *bp = __sync_lock_test_and_set(&deferred, NULL);
+    char *next;
+    int n = 0;
+
+    for (; bp != NULL; bp = next, n++) {
+        next = *(char **)bp;
+        free_block(bp);
+    }
+    __sync_sub_and_fetch(&deferred_count, n);
+}
+
+/*
+ * trim_top - If the last block is free and bigger than 2*TRIM_KEEP, shrink it to
+ * TRIM_KEEP bytes and give the rest back to memlib. Called with the heap lock.
+ */
+static void trim_top(void)
+{
+    char *epilogue = (char *)mem_heap_hi() + 1;
+    char *bp = PREV_BLKP(epilogue);
+    size_t size = GET_SIZE(HDRP(bp));
+    size_t zero = GET_ZERO(HDRP(bp));
+
+    if (GET_ALLOC(HDRP(bp)) || size <= 2 * TRIM_KEEP)
+        return;
+    delete(bp);
+    PUT(HDRP(bp), PACK(TRIM_KEEP, zero));
+    PUT(FTRP(bp), PACK(TRIM_KEEP, zero));
+    insert(bp);
+    mem_trim(size - TRIM_KEEP);
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));
+}
+
+/*
+ * maint_main - The maintenance thread. It wakes up every MAINT_PERIOD ns, or when
+ * DEFER_WAKE frees are waiting, and does its work with the heap lock held.
+ */
+static void *maint_main(void *arg)
+{
+    struct timespec until;
+    char *bp;
+    char *next;
+    size_t full_at = 0; /* heap size the last failed extension left, retried once it changes */
+
+    pthread_mutex_lock(&heap_lock);
+    while (maint_running) {
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += MAINT_PERIOD;
+        if (until.tv_nsec >= 1000000000) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&maint_wake, &heap_lock, &until);
+        trim_top();
+        if (free_bytes < LOW_WATER && mem_heapsize() != full_at
+            && extend_heap(TRIM_KEEP/WSIZE) == NULL)
+            full_at = mem_heapsize();
+
+        /* Free the deferred blocks one lock hold at a time, so the caller waits for one at most */
+        pthread_mutex_unlock(&heap_lock);
+        bp = __sync_lock_test_and_set(&deferred, NULL);
+        for (; bp != NULL; bp = next) {
+            next = *(char **)bp;
+            pthread_mutex_lock(&heap_lock);
+            free_block(bp);
+            pthread_mutex_unlock(&heap_lock);
+            __sync_sub_and_fetch(&deferred_count, 1);
+        }
+        pthread_mutex_lock(&heap_lock);
+    }
+    pthread_mutex_unlock(&heap_lock);
+    return NULL;
+}
+
+/*
+ * maint_start - Start the maintenance thread and turn on the heap lock.
+ * Returns 0, or -1 if the thread cannot be created.
+ */
+static int maint_start(void)
+{
+    if (maint_running)
+        return 0;
+    lock_init();
+    threaded = 1;
+    maint_running = 1;
+    if (pthread_create(&maint_thread, NULL, maint_main, NULL) != 0) {
+        threaded = mt_callers;
+        maint_running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * maint_stop - Stop the maintenance thread, free what it left on the deferred
+ * stack and turn off the heap lock unless MM_OPT_THREADS keeps it.
+ */
+static void maint_stop(void)
+{
+    if (!maint_running)
+        return;
+    pthread_mutex_lock(&heap_lock);
+    maint_running = 0;
+    pthread_cond_signal(&maint_wake);
+    pthread_mutex_unlock(&heap_lock);
+    pthread_join(maint_thread, NULL);
+    if (deferred != NULL)
+        drain_deferred();
+    threaded = mt_callers;
+}
+
+/*
+ * lock_init - Make heap_lock the first time it is needed, and hold it across fork
+ * from then on so that a child never copies a heap in the middle of an operation.
+ */
+static void lock_init(void)
+{
+    static int lock_ready;
+
+    if (lock_ready)
+        return;
+    lock_make();
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+    lock_ready = 1;
+}
+
+/*
+ * lock_make - Initialize heap_lock as a recursive mutex.
+ */
+static void lock_make(void)
+{
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&heap_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+/*
+ * fork_prepare, fork_parent - Hold the heap lock while the process forks.
+ */
+static void fork_prepare(void)
+{
+    LOCK();
+}
+
+static void fork_parent(void)
+{
+    UNLOCK();
+}
+
+/*
+ * fork_child - In the child, make heap_lock anew, since the lock copied from the
+ * parent belongs to a thread id the child does not have. The maintenance thread is
+ * not copied either; free what it left deferred.
+ */
+static void fork_child(void)
+{
+    if (!threaded)
+        return;
+    lock_make();
+    if (maint_running) {
+        maint_running = 0;
+        if (deferred != NULL)
+            drain_deferred();
+    }
+    threaded = mt_callers;
+}
@@ -2,8 +2,67 @@
 
 extern int mm_init (void);
 extern void *mm_malloc (size_t size);
+extern void *mm_malloc_hint (size_t size, int life);
+extern void *mm_calloc (size_t nmemb, size_t size);
+extern void *mm_memalign (size_t align, size_t size);
 extern void mm_free (void *ptr);
+extern void mm_free_sized (void *ptr, size_t size);
+extern size_t mm_usable_size (void *ptr);
+extern int mm_malloc_batch (size_t size, int n, void **out);
+extern void mm_free_batch (void **ptrs, int n);
 extern void *mm_realloc(void *ptr, size_t size);
+extern int mm_setopt(int opt, size_t val);
+extern int mm_checkpoint(const char *path);
+extern int mm_restore(const char *path);
+
+/* Options for mm_setopt */
+#define MM_OPT_PLACE_SPLIT 1  /* size threshold for size-segregated placement (0 = off) */
+#define MM_OPT_BACKGROUND 2   /* 1 starts the maintenance thread, 0 stops it (stop it before mm_init) */
+#define MM_OPT_THREADS 3      /* 1 locks the heap for callers on several threads (set while single-threaded) */
+#define MM_OPT_LINE_BLOCKS 4  /* 1 gives every block its own cache lines (mm_compact does not keep them) */
+#define MM_OPT_CHECK 5        /* heap checking done by the entry points, one of MM_CHECK_xxx */
+#define MM_OPT_CHECK_PERIOD 6 /* ops between two MM_CHECK_SAMPLE slices */
+#define MM_OPT_MIN_ALIGN 7    /* payload alignment of every block, 8 or 16 (set while the heap is empty) */
+
+#define MM_PLACE_SPLIT_DEFAULT 96
+#define MM_CHECK_PERIOD_DEFAULT 64
+
+/* Checking tiers for MM_OPT_CHECK; tiers 1 and 2 also run the tier 0 checks */
+#define MM_CHECK_OFF 0     /* no checking */
+#define MM_CHECK_LOCAL 1   /* tier 0, O(1): tags and list links around each block touched */
+#define MM_CHECK_SAMPLE 2  /* tier 1: a random slice of the heap every MM_OPT_CHECK_PERIOD ops */
+#define MM_CHECK_FULL 3    /* tier 2: the full mm_check walk on every op */
+
+/* Lifetime classes for mm_malloc_hint */
+#define MM_LIFE_DEFAULT 0  /* unknown: placed by size like mm_malloc */
+#define MM_LIFE_SHORT 1    /* freed soon: high end of the free block */
+#define MM_LIFE_LONG 2     /* freed late or never: low end of the free block */
+
+/* Regions: bump allocation from heap chunks, all freed at once by reset */
+typedef struct mm_region mm_region_t;
+
+extern mm_region_t *mm_region_create(void);
+extern void *mm_region_alloc(mm_region_t *r, size_t size);
+extern void mm_region_reset(mm_region_t *r);
+extern void mm_region_destroy(mm_region_t *r);
+
+/* Object pools: fixed-size objects from slabs, empty slabs go back to the heap */
+typedef struct mm_pool mm_pool_t;
+
+extern mm_pool_t *mm_pool_create(size_t objsize);
+extern void *mm_pool_alloc(mm_pool_t *pool);
+extern void mm_pool_free(mm_pool_t *pool, void *obj);
+extern void mm_pool_destroy(mm_pool_t *pool);
+
+/* Handles: movable blocks, pinned while locked, that mm_compact slides down */
+typedef struct mm_handle mm_handle_t;
+
+extern mm_handle_t *mm_halloc(size_t size);
+extern int mm_hrealloc(mm_handle_t *h, size_t size);
+extern void mm_hfree(mm_handle_t *h);
+extern void *mm_hlock(mm_handle_t *h);
+extern void mm_hunlock(mm_handle_t *h);
+extern size_t mm_compact(void);
 
 
 /* 
@@ -0,0 +1,65 @@
+#ifndef __MM_POOL_HPP_
+#define __MM_POOL_HPP_
+
+/*
+ * mm_pool.hpp - typed fixed-size object pool for C++ code using the mm package
+ *
+ * mm::object_pool<T> wraps an mm_pool_t: objects come from slabs that the
+ * pool takes from the mm heap, and slabs that become empty go back to it.
+ */
+#include <new>
+#include <utility>
+
+extern "C" {
+#include "mm.h"
+}
+
+namespace mm {
+
+template <typename T>
+class object_pool {
+public:
+    static_assert(alignof(T) <= 8, "mm pools only align objects to 8 bytes");
+
+    object_pool() : pool_(mm_pool_create(sizeof(T)))
+    {
+        if (pool_ == nullptr)
+            throw std::bad_alloc();
+    }
+
+    /* Every object must have been destroyed already */
+    ~object_pool() { mm_pool_destroy(pool_); }
+
+    object_pool(const object_pool &) = delete;
+    object_pool &operator=(const object_pool &) = delete;
+
+    /* Allocate an object and construct it from args */
+    template <typename... Args>
+    T *construct(Args &&...args)
+    {
+        void *p = mm_pool_alloc(pool_);
+
+        if (p == nullptr)
+            throw std::bad_alloc();
+        try {
+            return new (p) T(std::forward<Args>(args)...);
+        } catch (...) {
+            mm_pool_free(pool_, p);
+            throw;
+        }
+    }
+
+    /* Destroy an object made by construct and give its storage back */
+    void destroy(T *obj)
+    {
+        obj->~T();
+        mm_pool_free(pool_, obj);
+    }
+
+private:
+    mm_pool_t *pool_;
+};
+
+} /* namespace mm */
+
+#endif /* __MM_POOL_HPP_ */
@@ -0,0 +1,402 @@
+/*
+ * mmrec.c - Malloc recorder, to capture the malloc calls of a real program
+ *           as a trace:
+ *
+ *     LD_PRELOAD=./libmmrec.so <program>
+ *     ./rec2trace mmrec.<pid> <trace>.rep
+ *
+ * It passes malloc, calloc, realloc, free, memalign, posix_memalign and
+ * aligned_alloc on to libc and records each call (see record.h) to
+ * $MMREC_FILE.<pid>, or mmrec.<pid> by default, so a program that forks
+ * and execs others leaves a recording per process. A recording is never
+ * overwritten: a program that execs another in the same process, which
+ * keeps the pid, records it to mmrec.<pid>.1, then .2, and so on. A
+ * forked child that does not exec is not recorded.
+ *
+ * Each thread fills a buffer of its own, with no locks or atomics, and
+ * hands it to the kernel with one write() on the O_APPEND file when it is
+ * full, when the thread exits and when the program exits. Times are read
+ * from the TSC on x86, which takes a few ns where clock_gettime takes
+ * tens, so this assumes a TSC that is constant-rate and synchronized
+ * across cores, as on any recent x86. Allocation times are taken after
+ * the call returns and free times before it starts, so a block's free
+ * always sorts before the call that gets the same address back, even on
+ * another thread. Calls the recorder makes
+ * itself are passed on unrecorded, and calls made while dlsym is still
+ * looking for libc's functions are served from a small static arena.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "trace.h"
+#include "record.h"
+
+#define REC_BUF 8192          /* records per thread buffer, with its REC_CLOCK */
+#define ARENA_SIZE (1<<16)    /* bytes of the bootstrap arena */
+#define ARENA_ALIGN 16        /* alignment of arena blocks */
+#define REC_EXECS 1000        /* recordings a process may leave, one per exec */
+
+/* The records a thread has not written out yet */
+typedef struct {
+    record_t *recs;     /* REC_BUF records, mapped on first use */
+    int n;
+    uint32_t thread;
+} recbuf_t;
+
+/* libc's functions */
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+static void *(*real_memalign)(size_t, size_t);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void *(*real_aligned_alloc)(size_t, size_t);
+
+static int rec_fd = -1;         /* recording, or -1 if not recording */
+static uint64_t rec_start;      /* ticks when the recorder started... */
+static uint64_t rec_start_ns;   /* ... and clock ns */
+static uint32_t rec_threads;    /* threads seen so far */
+static pthread_key_t rec_key;   /* to write a thread's buffer when it exits */
+static char arena[ARENA_SIZE];
+static size_t arena_used;
+
+static __thread recbuf_t buf;
+static __thread int busy;       /* set while the recorder allocates itself */
+
+static void find_libc(void);
+static void *arena_alloc(size_t size, size_t align);
+static int in_arena(void *p);
+static int recording(void);
+static uint64_t now(void);
+static uint64_t now_ns(void);
+static void record(int type, void *ptr, void *old, size_t size, size_t align,
+		   uint64_t time);
+static int buf_init(void);
+static void flush(void);
+static void thread_exit(void *arg);
+static void child(void);
+
+
+/*
+ * rec_init - open the recording when the library is loaded
+ */
+__attribute__((constructor))
+static void rec_init(void)
+{
+    char path[FILENAME_MAX];
+    char *prefix;
+    int k;
+
+    busy = 1;
+    find_libc();
+    if ((prefix = getenv("MMREC_FILE")) == NULL)
+	prefix = "mmrec";
+    if (pthread_key_create(&rec_key, thread_exit) != 0 ||
+	pthread_atfork(NULL, NULL, child) != 0) {
+	fprintf(stderr, "mmrec: could not set up the recorder\n");
+	busy = 0;
+	return;
+    }
+    rec_start = now();
+    rec_start_ns = now_ns();
+    for (k = 0; k < REC_EXECS; k++) {
+	if (k == 0)
+	    snprintf(path, sizeof(path), "%s.%d", prefix, (int)getpid());
+	else
+	    snprintf(path, sizeof(path), "%s.%d.%d", prefix, (int)getpid(), k);
+	rec_fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0644);
+	if (rec_fd >= 0 || errno != EEXIST)
+	    break;
+    }
+    if (rec_fd < 0)
+	fprintf(stderr, "mmrec: could not create %s: %s\n", path, strerror(errno));
+    busy = 0;
+}
+
+/*
+ * rec_fini - write out the buffer of the thread that exits the program.
+ *     Threads still running then lose the records they have not written.
+ */
+__attribute__((destructor))
+static void rec_fini(void)
+{
+    if (rec_fd >= 0 && buf.recs != NULL && buf.n > 0)
+	flush();
+}
+
+/*
+ * The wrappers
+ */
+void *malloc(size_t size)
+{
+    void *p;
+
+    if (real_malloc == NULL && (find_libc(), real_malloc == NULL))
+	return arena_alloc(size, ARENA_ALIGN);
+    p = real_malloc(size);
+    if (p != NULL && recording())
+	record(ALLOC, p, NULL, size, 0, now());
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (real_calloc == NULL && (find_libc(), real_calloc == NULL)) {
+	if (size != 0 && nmemb > (size_t)-1 / size)
+	    return NULL;
+	return arena_alloc(nmemb * size, ARENA_ALIGN);   /* arena is zero */
+    }
+    p = real_calloc(nmemb, size);
+    if (p != NULL && recording())
+	record(CALLOC, p, NULL, nmemb * size, 0, now());
+    return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    if (real_realloc == NULL && (find_libc(), real_realloc == NULL))
+	return ptr == NULL ? arena_alloc(size, ARENA_ALIGN) : NULL;
+    if (in_arena(ptr)) {
+	/* Move a bootstrap block to libc; only its new block is recorded */
+	if ((p = malloc(size)) != NULL)
+	    memcpy(p, ptr, size < (size_t)(arena + ARENA_SIZE - (char *)ptr) ?
+		   size : (size_t)(arena + ARENA_SIZE - (char *)ptr));
+	return p;
+    }
+    p = real_realloc(ptr, size);
+    if ((p != NULL || size == 0) && recording())
+	record(REALLOC, p, ptr, size, 0, now());
+    return p;
+}
+
+void free(void *ptr)
+{
+    uint64_t time;
+
+    if (ptr == NULL || in_arena(ptr))
+	return;
+    if (!recording()) {
+	real_free(ptr);
+	return;
+    }
+    time = now();
+    real_free(ptr);
+    record(FREE, ptr, NULL, 0, 0, time);
+}
+
+void *memalign(size_t align, size_t size)
+{
+    void *p;
+
+    if (real_memalign == NULL && (find_libc(), real_memalign == NULL))
+	return arena_alloc(size, align);
+    p = real_memalign(align, size);
+    if (p != NULL && recording())
+	record(MEMALIGN, p, NULL, size, align, now());
+    return p;
+}
+
+int posix_memalign(void **memptr, size_t align, size_t size)
+{
+    int err;
+
+    if (real_posix_memalign == NULL && (find_libc(), real_posix_memalign == NULL))
+	return (*memptr = arena_alloc(size, align)) != NULL ? 0 : ENOMEM;
+    err = real_posix_memalign(memptr, align, size);
+    if (err == 0 && recording())
+	record(MEMALIGN, *memptr, NULL, size, align, now());
+    return err;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    void *p;
+
+    if (real_aligned_alloc == NULL && (find_libc(), real_aligned_alloc == NULL))
+	return arena_alloc(size, align);
+    p = real_aligned_alloc(align, size);
+    if (p != NULL && recording())
+	record(MEMALIGN, p, NULL, size, align, now());
+    return p;
+}
+
+/*
+ * Helper functions
+ */
+
+/*
+ * find_libc - look up libc's functions. dlsym may allocate, and those
+ *     calls find the function pointers still NULL and use the arena.
+ */
+static void find_libc(void)
+{
+    static int finding = 0;
+
+    if (finding)
+	return;
+    finding = 1;
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    real_memalign = dlsym(RTLD_NEXT, "memalign");
+    real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+    finding = 0;
+}
+
+/*
+ * arena_alloc - allocate size bytes aligned to align from the static
+ *     arena, which is never freed
+ */
+static void *arena_alloc(size_t size, size_t align)
+{
+    size_t start;
+
+    if (align < ARENA_ALIGN)
+	align = ARENA_ALIGN;
+    start = (arena_used + align - 1) & ~(align - 1);
+    if (start > ARENA_SIZE || size > ARENA_SIZE - start)
+	return NULL;
+    arena_used = start + size;
+    return arena + start;
+}
+
+/* in_arena - is p a block of the bootstrap arena? */
+static int in_arena(void *p)
+{
+    return (char *)p >= arena && (char *)p < arena + ARENA_SIZE;
+}
+
+/* recording - should the calling thread's calls be recorded? */
+static int recording(void)
+{
+    return rec_fd >= 0 && !busy;
+}
+
+/* now - the time in ticks */
+static uint64_t now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return now_ns();
+#endif
+}
+
+/* now_ns - the time in ns */
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * record - add a call to the thread's buffer, and write the buffer out
+ *     if that fills it
+ */
+static void record(int type, void *ptr, void *old, size_t size, size_t align,
+		   uint64_t time)
+{
+    record_t *r;
+
+    if (buf.recs == NULL && !buf_init())
+	return;
+    r = &buf.recs[buf.n];
+    r->time = time - rec_start;
+    r->ptr = (uintptr_t)ptr;
+    r->old = (uintptr_t)old;
+    r->size = size;
+    r->thread = buf.thread;
+    r->type = type;
+    r->align_log = align > 1 ? __builtin_ctzl(align) : 0;
+    r->unused = 0;
+    if (++buf.n == REC_BUF - 1)
+	flush();
+}
+
+/*
+ * buf_init - map the calling thread's buffer and number the thread.
+ *     Returns 0 if out of memory.
+ */
+static int buf_init(void)
+{
+    void *recs;
+
+    recs = mmap(NULL, REC_BUF * sizeof(record_t), PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (recs == MAP_FAILED)
+	return 0;
+    buf.recs = recs;
+    buf.n = 0;
+    buf.thread = __sync_fetch_and_add(&rec_threads, 1);
+    busy = 1;   /* pthread_setspecific may allocate */
+    pthread_setspecific(rec_key, &buf);
+    busy = 0;
+    return 1;
+}
+
+/*
+ * flush - write out the thread's buffer, ended by a REC_CLOCK record. A
+ *     single write on an O_APPEND file is not interleaved with other
+ *     threads' writes.
+ */
+static void flush(void)
+{
+    char *p = (char *)buf.recs;
+    size_t left;
+    ssize_t n;
+    record_t *r;
+
+    r = &buf.recs[buf.n++];
+    memset(r, 0, sizeof(*r));
+    r->time = now() - rec_start;
+    r->size = now_ns() - rec_start_ns;
+    r->thread = buf.thread;
+    r->type = REC_CLOCK;
+    left = buf.n * sizeof(record_t);
+
+    while (left > 0 && (n = write(rec_fd, p, left)) > 0) {
+	p += n;
+	left -= n;
+    }
+    buf.n = 0;
+}
+
+/*
+ * thread_exit - write out and unmap the buffer of an exiting thread
+ */
+static void thread_exit(void *arg)
+{
+    if (rec_fd >= 0 && buf.n > 0)
+	flush();
+    munmap(buf.recs, REC_BUF * sizeof(record_t));
+    buf.recs = NULL;
+}
+
+/*
+ * child - stop recording in a forked child: its addresses would mix with
+ *     the parent's, and the parent writes out the records they share
+ */
+static void child(void)
+{
+    rec_fd = -1;
+}
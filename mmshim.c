@@ -0,0 +1,196 @@
+/*
+ * mmshim.c - Run a whole program on mm instead of libc malloc:
+ *
+ *     LD_PRELOAD=./libmm.so <program>
+ *
+ * libmm.so is this file built with mm.c and memlib.c. It defines malloc,
+ * free, calloc, realloc, memalign, posix_memalign, aligned_alloc, valloc,
+ * pvalloc and malloc_usable_size on top of the mm entry points, and hides
+ * every other symbol so it never mixes with a copy of mm linked into the
+ * program itself (mdriver, say).
+ *
+ * The first call initializes memlib with room for a heap of $MM_HEAP_MB
+ * megabytes (SHIM_HEAP_MB by default), only reserved until the heap grows
+ * into it, then mm_init, and turns on the mm heap lock for callers on
+ * several threads. That lock is also held across fork (see lock_init in
+ * mm.c). mm aligns blocks to 8 bytes by default, but i386 glibc and GCC
+ * align malloc to 16 (max_align_t, SSE, operator new), so the shim also
+ * sets MM_OPT_MIN_ALIGN to SHIM_ALIGN and can hand out the blocks of
+ * mm_malloc, mm_calloc and mm_realloc as they are.
+ *
+ * Pointers that mm did not hand out, such as those of the dynamic
+ * loader's own allocator, are ignored by free; realloc fails on them
+ * with ENOMEM, since it cannot tell how many bytes to copy.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define SHIM_HEAP_MB 1024   /* default heap room in MB (mem_sbrk takes an int) */
+#define SHIM_ALIGN 16       /* alignment of every block, glibc's MALLOC_ALIGNMENT */
+
+#define SHIM_API __attribute__((visibility("default")))
+
+static pthread_once_t shim_once = PTHREAD_ONCE_INIT;
+static int shim_ready;          /* 1 if mm is up, -1 if it could not be */
+static char *heap_lo;           /* the room memlib has for the heap */
+static size_t heap_room;
+
+static void shim_init(void);
+static int ready(void);
+static int in_heap(void *p);
+
+
+/*
+ * shim_init - set up memlib and mm for the process, once
+ */
+static void shim_init(void)
+{
+    char *mb = getenv("MM_HEAP_MB");
+
+    heap_room = (size_t)(mb != NULL ? atoi(mb) : SHIM_HEAP_MB) << 20;
+    if (heap_room == 0 || heap_room > 0x7fffffff)
+	heap_room = (size_t)SHIM_HEAP_MB << 20;
+    mm_setopt(MM_OPT_MIN_ALIGN, SHIM_ALIGN);
+    if (mem_init_size(heap_room) < 0 || mm_init() < 0) {
+	shim_ready = -1;
+	return;
+    }
+    heap_lo = mem_heap_lo();
+    mm_setopt(MM_OPT_THREADS, 1);
+    shim_ready = 1;
+}
+
+/* ready - initialize mm if this is the first call; is it usable? */
+static int ready(void)
+{
+    if (shim_ready == 0)
+	pthread_once(&shim_once, shim_init);
+    return shim_ready > 0;
+}
+
+/* in_heap - was p handed out by mm? */
+static int in_heap(void *p)
+{
+    return (char *)p >= heap_lo && (char *)p < heap_lo + heap_room;
+}
+
+/*
+ * The malloc interface
+ */
+SHIM_API void *malloc(size_t size)
+{
+    void *p;
+
+    if (!ready() || size >= heap_room) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    if ((p = mm_malloc(size > 0 ? size : 1)) == NULL)
+	errno = ENOMEM;
+    return p;
+}
+
+SHIM_API void free(void *ptr)
+{
+    if (ptr != NULL && in_heap(ptr))
+	mm_free(ptr);
+}
+
+SHIM_API void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (size != 0 && nmemb > (size_t)-1 / size) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    if (!ready() || nmemb * size >= heap_room) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    if (nmemb == 0 || size == 0)
+	nmemb = size = 1;
+    if ((p = mm_calloc(nmemb, size)) == NULL)
+	errno = ENOMEM;
+    return p;
+}
+
+SHIM_API void *realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    if (ptr == NULL)
+	return malloc(size);
+    if (size == 0) {
+	free(ptr);
+	return NULL;
+    }
+    if (!in_heap(ptr) || size >= heap_room) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    if ((p = mm_realloc(ptr, size)) == NULL)
+	errno = ENOMEM;
+    return p;
+}
+
+SHIM_API void *memalign(size_t align, size_t size)
+{
+    void *p;
+
+    if (align == 0 || (align & (align - 1)) != 0) {
+	errno = EINVAL;
+	return NULL;
+    }
+    if (align < SHIM_ALIGN)
+	align = SHIM_ALIGN;
+    if (!ready() || size >= heap_room || align >= heap_room) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    if ((p = mm_memalign(align, size > 0 ? size : 1)) == NULL)
+	errno = ENOMEM;
+    return p;
+}
+
+SHIM_API int posix_memalign(void **memptr, size_t align, size_t size)
+{
+    void *p;
+
+    if (align % sizeof(void *) != 0 || (align & (align - 1)) != 0)
+	return EINVAL;
+    if ((p = memalign(align, size)) == NULL)
+	return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+
+SHIM_API void *aligned_alloc(size_t align, size_t size)
+{
+    return memalign(align, size);
+}
+
+SHIM_API void *valloc(size_t size)
+{
+    return memalign(mem_pagesize(), size);
+}
+
+SHIM_API void *pvalloc(size_t size)
+{
+    size_t page = mem_pagesize();
+
+    return memalign(page, (size + page - 1) & ~(page - 1));
+}
+
+SHIM_API size_t malloc_usable_size(void *ptr)
+{
+    if (ptr == NULL || !in_heap(ptr))
+	return 0;
+    return mm_usable_size(ptr);
+}
@@ -0,0 +1,121 @@
+/*
+ * poolbench.cc - microbenchmark of mm::object_pool against raw mm_malloc/mm_free
+ *
+ * Both variants run the same churn loop over a table of SLOTS tree nodes:
+ * each step picks a pseudo-random slot and frees the node in it, or
+ * allocates a node into it if it is empty.
+ *
+ * mm.c keeps its boundary tags and free list links in 4-byte words, so it
+ * only runs in a 32-bit build; poolbench is built -m32 like mdriver, and
+ * its speedup line is only meaningful there.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+extern "C" {
+#include "memlib.h"
+#include "fsecs.h"
+}
+#include "mm_pool.hpp"
+
+#define SLOTS 10000     /* live nodes at most */
+#define STEPS 1000000   /* churn steps per run */
+
+int verbose = 0;        /* needed by fsecs.c */
+
+/* A typical tree node */
+struct node {
+    node *left;
+    node *right;
+    long key;
+    long value;
+    int color;
+
+    node(long k, long v) : left(nullptr), right(nullptr), key(k), value(v), color(0) {}
+};
+
+static node *slots[SLOTS];
+
+/* Same pseudo-random slot sequence for both variants */
+static unsigned int next_slot(unsigned int *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return (*seed >> 8) % SLOTS;
+}
+
+/* Reset the heap and the slot table before a timed run */
+static void reset(void)
+{
+    mem_reset_brk();
+    if (mm_init() < 0) {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+    for (int i = 0; i < SLOTS; i++)
+        slots[i] = nullptr;
+}
+
+/* Churn with raw mm_malloc/mm_free and placement new */
+static void churn_malloc(void *)
+{
+    unsigned int seed = 1;
+
+    reset();
+    for (long i = 0; i < STEPS; i++) {
+        unsigned int s = next_slot(&seed);
+        if (slots[s] != nullptr) {
+            slots[s]->~node();
+            mm_free(slots[s]);
+            slots[s] = nullptr;
+        } else {
+            void *p = mm_malloc(sizeof(node));
+            if (p == nullptr) {
+                fprintf(stderr, "mm_malloc failed\n");
+                exit(1);
+            }
+            slots[s] = new (p) node(i, s);
+        }
+    }
+}
+
+/* Churn with mm::object_pool<node> */
+static void churn_pool(void *)
+{
+    unsigned int seed = 1;
+
+    reset();
+    mm::object_pool<node> pool;
+    for (long i = 0; i < STEPS; i++) {
+        unsigned int s = next_slot(&seed);
+        if (slots[s] != nullptr) {
+            pool.destroy(slots[s]);
+            slots[s] = nullptr;
+        } else {
+            slots[s] = pool.construct(i, (long)s);
+        }
+    }
+    for (int i = 0; i < SLOTS; i++) {
+        if (slots[i] != nullptr)
+            pool.destroy(slots[i]);
+    }
+}
+
+int main(void)
+{
+    double malloc_secs, pool_secs;
+
+    mem_init();
+    init_fsecs();
+
+    malloc_secs = fsecs(churn_malloc, nullptr);
+    pool_secs = fsecs(churn_pool, nullptr);
+
+    printf("%-22s%10s%10s\n", "churn loop", "secs", "Kops");
+    printf("%-22s%10.6f%10.0f\n", "mm_malloc/mm_free", malloc_secs, (STEPS/1e3)/malloc_secs);
+    printf("%-22s%10.6f%10.0f\n", "mm::object_pool", pool_secs, (STEPS/1e3)/pool_secs);
+    printf("pool speedup: %.2fx\n", malloc_secs/pool_secs);
+
+    mem_deinit();
+    return 0;
+}
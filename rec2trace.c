@@ -0,0 +1,342 @@
+/*
+ * rec2trace.c - Turn a recording of the malloc recorder (mmrec.c) into a
+ *               v2 trace, with thread and time columns, for mdriver.
+ *
+ * usage: rec2trace <recording> <out>
+ * The trace is written binary if out ends in .bin, and as .rep otherwise.
+ *
+ * The records are sorted by time, which is scaled from ticks to ns by
+ * the last REC_CLOCK record. Every block returned by malloc, calloc,
+ * memalign or realloc of NULL gets a new id, which it keeps through
+ * reallocs until it is freed. Frees and reallocs of blocks the recording
+ * never saw allocated, from before the recorder started or from functions
+ * it does not wrap, are dropped (a realloc becomes an alloc), as are
+ * zero-byte allocations, which mm does not hand out. A block returned
+ * while the recording has it live lost its free, which is put back.
+ * The recorder numbers every thread the program ever ran, and the trace
+ * has 16 bits for a thread, so a thread's number goes to the next new
+ * thread once its last record is done; more than 65536 threads live at
+ * once is an error.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+#include "record.h"
+
+/* A live block, in an open-addressing hash table keyed by address */
+typedef struct {
+    uint64_t addr;      /* 0 if the slot is empty */
+    uint32_t id;
+} slot_t;
+
+static slot_t *table;
+static size_t table_size;       /* a power of two */
+static size_t table_used;
+
+static trace_t trace;
+static int max_ops;
+static double ns_per_tick = 1;
+
+static record_t *read_records(char *path, size_t *n);
+static int record_cmp(const void *a, const void *b);
+static void number_threads(record_t **recs, size_t n);
+static void convert(record_t **recs, size_t n);
+static void add_op(int type, uint32_t index, uint64_t size, record_t *r);
+static slot_t *live_find(uint64_t addr);
+static void live_add(uint64_t addr, uint32_t id);
+static void live_remove(slot_t *s);
+static void unix_error(char *msg, char *path);
+
+
+int main(int argc, char **argv)
+{
+    record_t *records;
+    record_t **sorted;
+    record_t *clock = NULL;
+    size_t n, i, len;
+
+    if (argc != 3) {
+	fprintf(stderr, "usage: %s <recording> <out>\n", argv[0]);
+	fprintf(stderr, "Converts a recording of libmmrec.so to a trace, "
+		"binary if <out> ends in .bin.\n");
+	exit(1);
+    }
+    records = read_records(argv[1], &n);
+
+    /* Sort by time, each thread's records staying in their own order */
+    if ((sorted = (record_t **)malloc(n * sizeof(record_t *))) == NULL)
+	unix_error("malloc failed in rec2trace", NULL);
+    for (i = 0; i < n; i++)
+	sorted[i] = &records[i];
+    qsort(sorted, n, sizeof(record_t *), record_cmp);
+    for (i = 0; i < n; i++)
+	if (sorted[i]->type == REC_CLOCK)
+	    clock = sorted[i];
+    if (clock != NULL && clock->time > 0)
+	ns_per_tick = (double)clock->size / clock->time;
+
+    number_threads(sorted, n);
+    convert(sorted, n);
+    len = strlen(argv[2]);
+    if (len > 4 && strcmp(argv[2] + len - 4, ".bin") == 0)
+	write_trace_bin(&trace, argv[2]);
+    else
+	write_trace_rep(&trace, argv[2]);
+    printf("%lu records, %d ops on %d ids\n", (unsigned long)n,
+	   trace.num_ops, trace.num_ids);
+    exit(0);
+}
+
+/*
+ * read_records - read the whole recording at path and set n to the
+ *     number of records in it
+ */
+static record_t *read_records(char *path, size_t *n)
+{
+    FILE *f;
+    record_t *records;
+    long size;
+
+    if ((f = fopen(path, "rb")) == NULL)
+	unix_error("Could not open recording", path);
+    if (fseek(f, 0, SEEK_END) < 0 || (size = ftell(f)) < 0)
+	unix_error("Could not read recording", path);
+    rewind(f);
+    *n = size / sizeof(record_t);
+    if ((records = (record_t *)malloc(*n * sizeof(record_t) + 1)) == NULL)
+	unix_error("malloc failed in rec2trace", NULL);
+    if (fread(records, sizeof(record_t), *n, f) != *n)
+	unix_error("Could not read recording", path);
+    fclose(f);
+    return records;
+}
+
+/*
+ * record_cmp - qsort comparator for record pointers, by time and then by
+ *     position in the recording
+ */
+static int record_cmp(const void *a, const void *b)
+{
+    record_t *x = *(record_t **)a;
+    record_t *y = *(record_t **)b;
+
+    if (x->time != y->time)
+	return x->time < y->time ? -1 : 1;
+    return (x > y) - (x < y);
+}
+
+/*
+ * number_threads - renumber the threads of the sorted records densely,
+ *     the number of a thread coming free after its last record
+ */
+static void number_threads(record_t **recs, size_t n)
+{
+    uint32_t *num;      /* trace number of each recorder thread, or NONE */
+    uint32_t *spare;    /* numbers come free, a stack... */
+    uint32_t nspare = 0, used = 0, max = 0, t;
+    size_t *last;       /* position of each recorder thread's last record */
+    size_t i;
+
+    for (i = 0; i < n; i++)
+	if (recs[i]->thread > max)
+	    max = recs[i]->thread;
+    if (max > 0x3fffffff)
+	unix_error("Bogus thread number in recording", NULL);
+    if ((num = (uint32_t *)malloc((max + 1) * sizeof(uint32_t))) == NULL ||
+	(spare = (uint32_t *)malloc((max + 1) * sizeof(uint32_t))) == NULL ||
+	(last = (size_t *)malloc((max + 1) * sizeof(size_t))) == NULL)
+	unix_error("malloc failed in rec2trace", NULL);
+    memset(num, 0xff, (max + 1) * sizeof(uint32_t));
+    for (i = 0; i < n; i++)
+	last[recs[i]->thread] = i;
+
+    for (i = 0; i < n; i++) {
+	t = recs[i]->thread;
+	if (num[t] == 0xffffffff)
+	    num[t] = nspare > 0 ? spare[--nspare] : used++;
+	if (num[t] > 0xffff)
+	    unix_error("More than 65536 threads live at once in recording", NULL);
+	recs[i]->thread = num[t];
+	if (last[t] == i)
+	    spare[nspare++] = num[t];
+    }
+    free(num);
+    free(spare);
+    free(last);
+}
+
+/*
+ * convert - replay the sorted records on a table of live blocks and
+ *     turn them into the trace's ops
+ */
+static void convert(record_t **recs, size_t n)
+{
+    record_t *r;
+    slot_t *s;
+    uint32_t id;
+    size_t i;
+
+    /* Each record makes at most one op, plus one for a lost free */
+    if (n > 0x3fffffff)
+	unix_error("Recording too big", NULL);
+    max_ops = 2 * n;
+    trace.flags = TRACE_THREADS | TRACE_TIMES;
+    trace.weight = 1;
+    if ((trace.ops = (traceop_t *)calloc(max_ops, sizeof(traceop_t))) == NULL ||
+	(trace.times = (uint64_t *)malloc(max_ops * sizeof(uint64_t))) == NULL)
+	unix_error("malloc failed in rec2trace", NULL);
+    table_size = 1024;
+    if ((table = (slot_t *)calloc(table_size, sizeof(slot_t))) == NULL)
+	unix_error("malloc failed in rec2trace", NULL);
+
+    for (i = 0; i < n; i++) {
+	r = recs[i];
+	switch (r->type) {
+	case ALLOC:
+	case CALLOC:
+	case MEMALIGN:
+	    if (r->size == 0)
+		break;
+	    if ((s = live_find(r->ptr)) != NULL) {
+		add_op(FREE, s->id, 0, r);
+		live_remove(s);
+	    }
+	    add_op(r->type, trace.num_ids, r->size, r);
+	    live_add(r->ptr, trace.num_ids++);
+	    break;
+	case REALLOC:
+	    s = r->old != 0 ? live_find(r->old) : NULL;
+	    if (r->ptr == 0) {          /* realloc to 0 bytes freed the block */
+		if (s != NULL) {
+		    add_op(FREE, s->id, 0, r);
+		    live_remove(s);
+		}
+		break;
+	    }
+	    if (s == NULL) {            /* realloc of NULL, or of a block we missed */
+		if (r->size == 0)
+		    break;
+		if ((s = live_find(r->ptr)) != NULL) {
+		    add_op(FREE, s->id, 0, r);
+		    live_remove(s);
+		}
+		add_op(ALLOC, trace.num_ids, r->size, r);
+		live_add(r->ptr, trace.num_ids++);
+		break;
+	    }
+	    id = s->id;
+	    live_remove(s);
+	    if ((s = live_find(r->ptr)) != NULL) {
+		add_op(FREE, s->id, 0, r);
+		live_remove(s);
+	    }
+	    add_op(REALLOC, id, r->size, r);
+	    live_add(r->ptr, id);
+	    break;
+	case FREE:
+	    if ((s = live_find(r->ptr)) != NULL) {
+		add_op(FREE, s->id, 0, r);
+		live_remove(s);
+	    }
+	    break;
+	case REC_CLOCK:
+	    break;
+	default:
+	    fprintf(stderr, "Bogus record type %d\n", r->type);
+	    exit(1);
+	}
+    }
+}
+
+/*
+ * add_op - append an op made from record r to the trace
+ */
+static void add_op(int type, uint32_t index, uint64_t size, record_t *r)
+{
+    traceop_t *op = &trace.ops[trace.num_ops];
+
+    op->type = type;
+    op->index = index;
+    op->size = size;
+    op->align_log = type == MEMALIGN ? r->align_log : 0;
+    op->thread = r->thread;
+    trace.times[trace.num_ops++] = r->time * ns_per_tick;
+}
+
+/*
+ * live_find - return the slot of the live block at addr, or NULL
+ */
+static slot_t *live_find(uint64_t addr)
+{
+    size_t i;
+
+    for (i = (addr >> 4) & (table_size - 1); table[i].addr != 0;
+	 i = (i + 1) & (table_size - 1))
+	if (table[i].addr == addr)
+	    return &table[i];
+    return NULL;
+}
+
+/*
+ * live_add - add a live block, doubling the table when it is half full
+ */
+static void live_add(uint64_t addr, uint32_t id)
+{
+    slot_t *old = table;
+    size_t old_size = table_size;
+    size_t i;
+
+    if (2 * (table_used + 1) > table_size) {
+	table_size *= 2;
+	if ((table = (slot_t *)calloc(table_size, sizeof(slot_t))) == NULL)
+	    unix_error("malloc failed in rec2trace", NULL);
+	table_used = 0;
+	for (i = 0; i < old_size; i++)
+	    if (old[i].addr != 0)
+		live_add(old[i].addr, old[i].id);
+	free(old);
+    }
+    for (i = (addr >> 4) & (table_size - 1); table[i].addr != 0;
+	 i = (i + 1) & (table_size - 1))
+	;
+    table[i].addr = addr;
+    table[i].id = id;
+    table_used++;
+}
+
+/*
+ * live_remove - empty slot s, moving up the later slots of its run that
+ *     would no longer be found past the hole
+ */
+static void live_remove(slot_t *s)
+{
+    size_t hole = s - table;
+    size_t i, home;
+
+    table[hole].addr = 0;
+    table_used--;
+    for (i = (hole + 1) & (table_size - 1); table[i].addr != 0;
+	 i = (i + 1) & (table_size - 1)) {
+	home = (table[i].addr >> 4) & (table_size - 1);
+	/* Move slot i into the hole unless its home lies in (hole, i] */
+	if (((i - home) & (table_size - 1)) >= ((i - hole) & (table_size - 1))) {
+	    table[hole] = table[i];
+	    table[i].addr = 0;
+	    hole = i;
+	}
+    }
+}
+
+/*
+ * unix_error - Report a Unix-style error, about path if it is set, and exit
+ */
+static void unix_error(char *msg, char *path)
+{
+    if (path != NULL)
+	fprintf(stderr, "%s %s\n", msg, path);
+    else
+	fprintf(stderr, "%s\n", msg);
+    exit(1);
+}
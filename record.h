@@ -0,0 +1,25 @@
+/*
+ * record.h - Calls recorded by the malloc recorder (mmrec.c), as read by
+ * rec2trace. A recording is a plain array of these records in host byte
+ * order. Each thread's records are in program order, but threads write
+ * theirs out in chunks, so the file as a whole is not in time order.
+ * Include trace.h first, for the request types.
+ *
+ * Times are in clock ticks, the TSC on x86 and ns elsewhere. Every chunk
+ * ends with a REC_CLOCK record giving the ns elapsed at some tick count,
+ * which the last one of scales all times by.
+ */
+#include <stdint.h>
+
+typedef struct {
+    uint64_t time;      /* ticks since the recorder started */
+    uint64_t ptr;       /* block returned, or freed by FREE; 0 if realloc freed */
+    uint64_t old;       /* block passed to realloc */
+    uint64_t size;      /* bytes asked for, nmemb*size for calloc */
+    uint32_t thread;    /* recorder's number for the calling thread */
+    uint8_t type;       /* ALLOC, FREE, REALLOC, CALLOC or MEMALIGN */
+    uint8_t align_log;  /* log2 of the alignment asked of memalign */
+    uint16_t unused;    /* always 0 */
+} record_t;
+
+#define REC_CLOCK 0xff  /* type of a record with ns, in size, at ticks time */
@@ -0,0 +1,906 @@
+/*
+ * trace.c - Reading and writing malloc lab traces, for mdriver and the
+ *           tracecvt converter.
+ *
+ * A .rep trace is text: an optional version line (see trace.h), four
+ * header numbers (suggested heap size, number of ids, number of ops,
+ * weight) and then one request per line. It is
+ * mapped and decoded by a hand-written parser rather than with fscanf,
+ * which was most of the startup cost on big traces; a malformed line is
+ * reported with its line number. A binary
+ * trace (see trace.h) is mapped into memory as it is and replayed from
+ * the mapping, with no parsing or copying.
+ *
+ * A trace stream reads a trace of either format in chunks of STREAM_CHUNK
+ * ops instead, for traces that do not fit in memory. A reader thread fills
+ * one of two buffers while the caller replays the other. Nothing it keeps
+ * grows with the number of ids in the header, only with the ids live at
+ * once: the size of each live id, for the sized free check, is in an
+ * idmap, a hash table that callers can use for their own blocks as well.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#include "trace.h"
+
+#define STREAM_CHUNK (1<<16)  /* ops per stream buffer */
+#define REP_BUF (1<<20)       /* bytes of .rep text buffered by a stream... */
+#define REP_LINE 4096         /* ... of which a request line may use at most */
+#define IDMAP_MIN 1024        /* slots of a new idmap */
+
+/*
+ * The unparsed text of a .rep trace: either all of it, mapped, or a
+ * buffer that a stream refills from file.
+ */
+typedef struct {
+    char *p;            /* next character to parse... */
+    char *end;          /* ... and the end of the text we have */
+    char *buf;          /* REP_BUF bytes, NULL if the whole trace is mapped */
+    FILE *file;
+    char *path;
+    unsigned line;      /* line number of p */
+    int flags;          /* optional columns of the trace */
+} rep_t;
+
+/*
+ * The two buffers of a trace stream. Buffer k is full while it holds ops
+ * the caller has not taken yet or still replays; a full buffer with no ops
+ * marks the end of the trace.
+ */
+struct trace_stream {
+    FILE *file;
+    char path[FILENAME_MAX];
+    int binary;                 /* binary records, or .rep lines? */
+    rep_t rep;                  /* the text of a .rep trace... */
+    uint64_t left;              /* ... or the records of a binary one not read yet */
+    uint64_t num_ids;           /* ids in the header... */
+    idmap_t *sizes;             /* ... the size of each live one, to check sized frees... */
+    uint64_t ops_read;          /* ... and the ops read so far */
+    pthread_t reader;
+    pthread_mutex_t lock;
+    pthread_cond_t filled;      /* a buffer became full... */
+    pthread_cond_t drained;     /* ... or empty again */
+    traceop_t *buf[2];
+    size_t count[2];            /* ops in each full buffer */
+    int full[2];
+    int next;                   /* buffer the caller takes next */
+    int held;                   /* buffer the caller replays, -1 if none */
+    int stop;                   /* set by close_trace_stream */
+};
+
+static trace_t *read_trace_rep(FILE *tracefile, char *path, trace_t *trace);
+static trace_t *map_trace(int fd, char *path, trace_t *trace);
+static void alloc_blocks(trace_t *trace);
+static int parse_op(rep_t *r, traceop_t *op, uint64_t *time);
+static int parse_version(rep_t *r);
+static void parse_header(rep_t *r, uint64_t header[4]);
+static uint64_t parse_number(rep_t *r);
+static int skip_space(rep_t *r);
+static void skip_blanks(rep_t *r);
+static int rep_fill(rep_t *r);
+static void rep_error(rep_t *r, unsigned line, char *msg);
+static char *check_op(traceop_t *op, uint64_t num_ids);
+static char *check_free(traceop_t *op, uint64_t *size);
+static size_t idmap_home(idmap_t *m, uint64_t key);
+static void op_error(char *msg, uint64_t opnum, char *path);
+static size_t read_ops(trace_stream_t *s, traceop_t *ops, size_t max);
+static void *stream_reader(void *arg);
+static void trace_error(char *msg, char *path);
+
+
+/*
+ * read_trace - read a trace file and store it in memory. A binary
+ *     trace is recognized by its magic number and mapped instead.
+ */
+trace_t *read_trace(char *tracedir, char *filename)
+{
+    FILE *tracefile;
+    trace_t *trace;
+    char path[FILENAME_MAX];
+    uint32_t magic;
+
+    /* Allocate the trace record */
+    if ((trace = (trace_t *) calloc(1, sizeof(trace_t))) == NULL)
+	trace_error("calloc failed in read_trace", NULL);
+	
+    strcpy(path, tracedir);
+    strcat(path, filename);
+    if ((tracefile = fopen(path, "r")) == NULL)
+	trace_error("Could not open trace", path);
+    if (fread(&magic, sizeof(magic), 1, tracefile) == 1 && magic == TRACE_MAGIC) {
+	trace = map_trace(fileno(tracefile), path, trace);
+	fclose(tracefile);
+	return trace;
+    }
+    rewind(tracefile);
+    return read_trace_rep(tracefile, path, trace);
+}
+
+/*
+ * read_trace_rep - map a .rep trace and parse its requests into a new array
+ */
+static trace_t *read_trace_rep(FILE *tracefile, char *path, trace_t *trace)
+{
+    struct stat st;
+    rep_t r;
+    char *text = NULL;
+    traceop_t op;
+    uint64_t header[4];
+    uint64_t time;
+    unsigned max_index = 0;
+    unsigned op_index;
+
+    if (fstat(fileno(tracefile), &st) < 0)
+	trace_error("Could not stat trace", path);
+    if (st.st_size > 0 &&
+	(text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, 
+		     fileno(tracefile), 0)) == MAP_FAILED)
+	trace_error("Could not map trace", path);
+    memset(&r, 0, sizeof(r));
+    r.p = text;
+    r.end = text + st.st_size;
+    r.path = path;
+    r.line = 1;
+
+    /* Read the trace file header */
+    trace->flags = r.flags = parse_version(&r);
+    parse_header(&r, header);
+    if (header[1] > 0x7fffffff || header[2] > 0x7fffffff)
+	rep_error(&r, r.line, "Header count too big");
+    trace->sugg_heapsize = header[0]; /* not used */
+    trace->num_ids = header[1];
+    trace->num_ops = header[2];
+    trace->weight = header[3];        /* not used */
+    
+    /* We'll store each request line in the trace in this array */
+    if ((trace->ops = 
+	 (traceop_t *)calloc(trace->num_ops, sizeof(traceop_t))) == NULL)
+	trace_error("calloc failed in read_trace", NULL);
+    if ((trace->flags & TRACE_TIMES) && (trace->times = 
+	 (uint64_t *)malloc(trace->num_ops * sizeof(uint64_t))) == NULL)
+	trace_error("malloc failed in read_trace", NULL);
+    alloc_blocks(trace);
+    
+    /* 
+     * read every request line in the trace file, keeping the size of each
+     * id in block_sizes to check sized frees against
+     */
+    memset(trace->block_sizes, 0, trace->num_ids * sizeof(size_t));
+    op_index = 0;
+    while (parse_op(&r, &op, &time)) {
+	if (op_index >= (unsigned)trace->num_ops)
+	    rep_error(&r, r.line, "More requests than the header says");
+	if (op.index >= (unsigned)trace->num_ids)
+	    rep_error(&r, r.line, "Id out of the header's range");
+	if (op.type != FREE) {
+	    trace->block_sizes[op.index] = op.size;
+	    if (op.index > max_index)
+		max_index = op.index;
+	}
+	else if (op.size != 0 && op.size != trace->block_sizes[op.index])
+	    rep_error(&r, r.line, "Sized free of the wrong size");
+	if (trace->times != NULL)
+	    trace->times[op_index] = time;
+	trace->ops[op_index++] = op;
+    }
+    if (text != NULL)
+	munmap(text, st.st_size);
+    fclose(tracefile);
+    if (op_index != (unsigned)trace->num_ops)
+	rep_error(&r, r.line, "Fewer requests than the header says");
+    if (trace->num_ids > 0 && max_index != (unsigned)trace->num_ids - 1)
+	rep_error(&r, r.line, "Fewer ids than the header says");
+    
+    return trace;
+}
+
+/*
+ * parse_header - parse the four header numbers of a .rep trace
+ */
+static void parse_header(rep_t *r, uint64_t header[4])
+{
+    int i;
+
+    for (i = 0; i < 4; i++) {
+	if (!skip_space(r))
+	    rep_error(r, r->line, "Truncated header");
+	header[i] = parse_number(r);
+    }
+}
+
+/*
+ * parse_version - parse the version line of a v2 .rep trace and return
+ *     the flags of the columns it names, or 0 for a v1 trace
+ */
+static int parse_version(rep_t *r)
+{
+    char *word;
+    int flags = 0;
+
+    if (!skip_space(r) || *r->p != 'v')
+	return 0;
+    r->p++;
+    if (parse_number(r) != 2)
+	rep_error(r, r->line, "Unsupported trace version");
+    for (;;) {
+	skip_blanks(r);
+	if (r->p == r->end || *r->p == '\n')
+	    return flags;
+	for (word = r->p; r->p < r->end && *r->p > ' '; r->p++)
+	    ;
+	if (r->p - word == 6 && strncmp(word, "thread", 6) == 0)
+	    flags |= TRACE_THREADS;
+	else if (r->p - word == 4 && strncmp(word, "time", 4) == 0)
+	    flags |= TRACE_TIMES;
+	else
+	    rep_error(r, r->line, "Unknown column");
+    }
+}
+
+/*
+ * parse_op - parse the next request line of a .rep trace into op, and
+ *     its timestamp into time if the trace has them, leaving r->p at the
+ *     end of the line. Returns 0 at the end of the trace.
+ */
+static int parse_op(rep_t *r, traceop_t *op, uint64_t *time)
+{
+    uint64_t index, align, thread;
+    unsigned line;
+    int align_log;
+    char type;
+
+    if (!skip_space(r))
+	return 0;
+    if (r->buf != NULL && r->end - r->p < REP_LINE)
+	rep_fill(r);
+    line = r->line;
+    type = *r->p++;
+    if (r->p < r->end && *r->p != ' ' && *r->p != '\t')
+	rep_error(r, line, "Bogus request type");
+
+    memset(op, 0, sizeof(*op));
+    index = parse_number(r);
+    switch(type) {
+    case 'a':
+	op->type = ALLOC;
+	op->size = parse_number(r);
+	break;
+    case 'r':
+	op->type = REALLOC;
+	op->size = parse_number(r);
+	break;
+    case 'c':
+	op->type = CALLOC;
+	op->size = parse_number(r);
+	break;
+    case 'm':
+	op->type = MEMALIGN;
+	op->size = parse_number(r);
+	align = parse_number(r);
+	for (align_log = 0; align_log < 31 && ((uint64_t)1 << align_log) < align; align_log++)
+	    ;
+	if (((uint64_t)1 << align_log) != align)
+	    rep_error(r, line, "Bogus alignment");
+	op->align_log = align_log;
+	break;
+    case 'f':
+	op->type = FREE;
+	break;
+    case 's':
+	op->type = FREE;
+	op->size = parse_number(r);
+	break;
+    default:
+	rep_error(r, line, "Bogus request type");
+    }
+    if (index > 0xffffffff)
+	rep_error(r, line, "Id too big");
+    op->index = index;
+
+    /* The optional columns, and nothing else, may follow */
+    if (r->flags & TRACE_THREADS) {
+	if ((thread = parse_number(r)) > 0xffff)
+	    rep_error(r, line, "Thread id too big");
+	op->thread = thread;
+    }
+    if (r->flags & TRACE_TIMES)
+	*time = parse_number(r);
+    skip_blanks(r);
+    if (r->p < r->end && *r->p != '\n')
+	rep_error(r, line, "Junk after the request");
+    return 1;
+}
+
+/*
+ * parse_number - parse the decimal number after the blanks at r->p.
+ *     Up to 19 digits always fit in 64 bits, so only the length is checked.
+ */
+static uint64_t parse_number(rep_t *r)
+{
+    char *p = r->p;
+    char *end = r->end;
+    char *digits;
+    uint64_t n = 0;
+    unsigned d = 0;
+
+    while (p < end && (*p == ' ' || *p == '\t'))
+	p++;
+    if (p == end || (d = (unsigned char)*p - '0') > 9)
+	rep_error(r, r->line, "Expected a number");
+    digits = p;
+    do {
+	n = n * 10 + d;
+    } while (++p < end && (d = (unsigned char)*p - '0') <= 9);
+    if (p - digits > 19)
+	rep_error(r, r->line, "Number too big");
+    r->p = p;
+    return n;
+}
+
+/*
+ * skip_space - skip blanks and line breaks, refilling a stream's buffer
+ *     as needed. Returns 0 at the end of the trace.
+ */
+static int skip_space(rep_t *r)
+{
+    for (;;) {
+	while (r->p < r->end && (*r->p == ' ' || *r->p == '\n' ||
+				 *r->p == '\t' || *r->p == '\r'))
+	    if (*r->p++ == '\n')
+		r->line++;
+	if (r->p < r->end)
+	    return 1;
+	if (!rep_fill(r))
+	    return 0;
+    }
+}
+
+/*
+ * skip_blanks - skip blanks up to the end of the line
+ */
+static void skip_blanks(rep_t *r)
+{
+    while (r->p < r->end && (*r->p == ' ' || *r->p == '\t' || *r->p == '\r'))
+	r->p++;
+}
+
+/*
+ * rep_fill - move the unparsed text of a stream to the start of its
+ *     buffer and read more after it. Returns 0 if nothing more was read.
+ */
+static int rep_fill(rep_t *r)
+{
+    size_t left, n;
+
+    if (r->buf == NULL)
+	return 0;
+    left = r->end - r->p;
+    memmove(r->buf, r->p, left);
+    n = fread(r->buf + left, 1, REP_BUF - left, r->file);
+    r->p = r->buf;
+    r->end = r->buf + left + n;
+    return n > 0;
+}
+
+/*
+ * rep_error - Report a malformed line of a .rep trace and exit
+ */
+static void rep_error(rep_t *r, unsigned line, char *msg)
+{
+    printf("%s at line %u of tracefile %s\n", msg, line, r->path);
+    exit(1);
+}
+
+/*
+ * check_op - check a request that was not parsed from text, which can
+ *     hold anything. Returns what is wrong with the request, or NULL if
+ *     it is fine.
+ */
+static char *check_op(traceop_t *op, uint64_t num_ids)
+{
+    if (op->type > MEMALIGN)
+	return "Bogus request type";
+    if (op->index >= num_ids)
+	return "Id out of the header's range";
+    if (op->type == MEMALIGN && op->align_log > 31)
+	return "Bogus alignment";
+    return NULL;
+}
+
+/*
+ * check_free - check a sized free against *size, the size of its id so
+ *     far, or set *size from an allocation. Returns what is wrong, or NULL.
+ */
+static char *check_free(traceop_t *op, uint64_t *size)
+{
+    if (op->type != FREE)
+	*size = op->size;
+    else if (op->size != 0 && op->size != *size)
+	return "Sized free of the wrong size";
+    return NULL;
+}
+
+/*
+ * op_error - report a bad request of a trace, counting from 0, and exit
+ */
+static void op_error(char *msg, uint64_t opnum, char *path)
+{
+    printf("%s at request %llu of tracefile %s\n", msg, (unsigned long long)opnum,
+	   path);
+    exit(1);
+}
+
+/*
+ * map_trace - map the binary trace open on fd and point the trace's
+ *     ops at the records in the mapping. The records are checked in one
+ *     pass over the mapping, as a .rep trace is while it is parsed.
+ */
+static trace_t *map_trace(int fd, char *path, trace_t *trace)
+{
+    struct stat st;
+    tracehdr_t *hdr;
+    size_t hdr_size, op_size;
+    uint64_t *sizes;
+    char *msg;
+    int i;
+
+    if (fstat(fd, &st) < 0)
+	trace_error("Could not stat trace", path);
+    if ((size_t)st.st_size < TRACE_HDR_V1)
+	trace_error("Truncated binary trace", path);
+    trace->map_size = st.st_size;
+    trace->map = mmap(NULL, trace->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (trace->map == MAP_FAILED)
+	trace_error("Could not map trace", path);
+
+    hdr = (tracehdr_t *)trace->map;
+    if (hdr->version == 1)
+	hdr_size = TRACE_HDR_V1;
+    else if (hdr->version == TRACE_VERSION && trace->map_size >= sizeof(tracehdr_t)) {
+	hdr_size = sizeof(tracehdr_t);
+	trace->flags = hdr->flags;
+    }
+    else
+	trace_error("Unsupported binary trace version", path);
+    op_size = sizeof(traceop_t);
+    if (trace->flags & TRACE_TIMES)
+	op_size += sizeof(uint64_t);
+    if (hdr->num_ops > (trace->map_size - hdr_size) / op_size ||
+	hdr->num_ops > 0x7fffffff || hdr->num_ids > 0x7fffffff)
+	trace_error("Truncated binary trace", path);
+    trace->sugg_heapsize = hdr->sugg_heapsize;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->weight = hdr->weight;
+    trace->ops = (traceop_t *)((char *)trace->map + hdr_size);
+    if (trace->flags & TRACE_TIMES)
+	trace->times = (uint64_t *)(trace->ops + trace->num_ops);
+    alloc_blocks(trace);
+
+    if ((sizes = (uint64_t *)calloc(trace->num_ids + 1, sizeof(uint64_t))) == NULL)
+	trace_error("calloc failed in read_trace", NULL);
+    for (i = 0; i < trace->num_ops; i++)
+	if ((msg = check_op(&trace->ops[i], trace->num_ids)) != NULL ||
+	    (msg = check_free(&trace->ops[i], &sizes[trace->ops[i].index])) != NULL)
+	    op_error(msg, i, path);
+    free(sizes);
+    return trace;
+}
+
+/*
+ * alloc_blocks - make the trace's per-id arrays
+ */
+static void alloc_blocks(trace_t *trace)
+{
+    /* We'll keep an array of pointers to the allocated blocks here... */
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	trace_error("malloc failed in read_trace", NULL);
+
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	trace_error("malloc failed in read_trace", NULL);
+}
+
+/*
+ * free_trace - Free the trace record and the arrays it points
+ *              to, or unmap its binary trace file.
+ */
+void free_trace(trace_t *trace)
+{
+    if (trace->map != NULL)   /* unmap the binary trace... */
+	munmap(trace->map, trace->map_size);
+    else {                    /* ... or free the arrays */
+	free(trace->ops);
+	free(trace->times);
+    }
+    free(trace->blocks);      
+    free(trace->block_sizes);
+    free(trace);              /* and the trace record itself... */
+}
+
+/*
+ * write_trace_rep - write the trace to path in the .rep format
+ */
+void write_trace_rep(trace_t *trace, char *path)
+{
+    FILE *f;
+    traceop_t *op;
+    int i;
+
+    if ((f = fopen(path, "w")) == NULL)
+	trace_error("Could not create trace", path);
+    if (trace->flags != 0)
+	fprintf(f, "v2%s%s\n", (trace->flags & TRACE_THREADS) ? " thread" : "",
+		(trace->flags & TRACE_TIMES) ? " time" : "");
+    fprintf(f, "%d\n%d\n%d\n%d\n", trace->sugg_heapsize, trace->num_ids,
+	    trace->num_ops, trace->weight);
+    for (i = 0; i < trace->num_ops; i++) {
+	op = &trace->ops[i];
+	switch (op->type) {
+	case ALLOC:
+	    fprintf(f, "a %u %llu", op->index, (unsigned long long)op->size);
+	    break;
+	case REALLOC:
+	    fprintf(f, "r %u %llu", op->index, (unsigned long long)op->size);
+	    break;
+	case CALLOC:
+	    fprintf(f, "c %u %llu", op->index, (unsigned long long)op->size);
+	    break;
+	case MEMALIGN:
+	    fprintf(f, "m %u %llu %lu", op->index, 
+		    (unsigned long long)op->size, (unsigned long)OP_ALIGN(*op));
+	    break;
+	case FREE:
+	    if (op->size != 0)
+		fprintf(f, "s %u %llu", op->index, (unsigned long long)op->size);
+	    else
+		fprintf(f, "f %u", op->index);
+	    break;
+	}
+	if (trace->flags & TRACE_THREADS)
+	    fprintf(f, " %u", op->thread);
+	if (trace->flags & TRACE_TIMES)
+	    fprintf(f, " %llu", (unsigned long long)trace->times[i]);
+	fputc('\n', f);
+    }
+    if (fclose(f) != 0)
+	trace_error("Could not write trace", path);
+}
+
+/*
+ * write_trace_bin - write the trace to path in the binary format
+ */
+void write_trace_bin(trace_t *trace, char *path)
+{
+    FILE *f;
+    tracehdr_t hdr;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = TRACE_MAGIC;
+    hdr.version = TRACE_VERSION;
+    hdr.num_ids = trace->num_ids;
+    hdr.weight = trace->weight;
+    hdr.num_ops = trace->num_ops;
+    hdr.sugg_heapsize = trace->sugg_heapsize;
+    hdr.flags = trace->flags;
+
+    if ((f = fopen(path, "wb")) == NULL)
+	trace_error("Could not create trace", path);
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+	fwrite(trace->ops, sizeof(traceop_t), trace->num_ops, f) != (size_t)trace->num_ops ||
+	(trace->times != NULL && 
+	 fwrite(trace->times, sizeof(uint64_t), trace->num_ops, f) != (size_t)trace->num_ops) ||
+	fclose(f) != 0)
+	trace_error("Could not write trace", path);
+}
+
+/*
+ * open_trace_stream - open the trace at path, of either format, for
+ *     reading in chunks, and start its reader thread. Sets num_ids and
+ *     num_ops from the trace header.
+ */
+trace_stream_t *open_trace_stream(char *path, uint64_t *num_ids, uint64_t *num_ops)
+{
+    trace_stream_t *s;
+    tracehdr_t hdr;
+    uint64_t header[4];
+    int k;
+
+    if ((s = (trace_stream_t *)calloc(1, sizeof(trace_stream_t))) == NULL)
+	trace_error("calloc failed in open_trace_stream", NULL);
+    strcpy(s->path, path);
+    if ((s->file = fopen(path, "r")) == NULL)
+	trace_error("Could not open trace", path);
+
+    if (fread(&hdr, TRACE_HDR_V1, 1, s->file) == 1 && hdr.magic == TRACE_MAGIC) {
+	if (hdr.version == TRACE_VERSION &&
+	    fread(&hdr.flags, sizeof(hdr) - TRACE_HDR_V1, 1, s->file) != 1)
+	    trace_error("Truncated binary trace", path);
+	else if (hdr.version != 1 && hdr.version != TRACE_VERSION)
+	    trace_error("Unsupported binary trace version", path);
+	s->binary = 1;
+	s->left = hdr.num_ops;
+	*num_ids = hdr.num_ids;
+	*num_ops = hdr.num_ops;
+    } else {
+	rewind(s->file);
+	if ((s->rep.buf = (char *)malloc(REP_BUF)) == NULL)
+	    trace_error("malloc failed in open_trace_stream", NULL);
+	s->rep.p = s->rep.end = s->rep.buf;
+	s->rep.file = s->file;
+	s->rep.path = s->path;
+	s->rep.line = 1;
+	s->rep.flags = parse_version(&s->rep);
+	parse_header(&s->rep, header);
+	*num_ids = header[1];
+	*num_ops = header[2];
+    }
+    s->num_ids = *num_ids;
+    s->sizes = idmap_new();
+
+    for (k = 0; k < 2; k++)
+	if ((s->buf[k] = (traceop_t *)malloc(STREAM_CHUNK * sizeof(traceop_t))) == NULL)
+	    trace_error("malloc failed in open_trace_stream", NULL);
+    s->held = -1;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->filled, NULL);
+    pthread_cond_init(&s->drained, NULL);
+    if (pthread_create(&s->reader, NULL, stream_reader, s) != 0)
+	trace_error("Could not start the trace reader", path);
+    return s;
+}
+
+/*
+ * next_trace_chunk - give back the chunk taken last and take the next
+ *     one, waiting for the reader if it is not full yet. Sets ops to the
+ *     chunk and returns the number of ops in it, 0 at the end of the trace.
+ */
+size_t next_trace_chunk(trace_stream_t *s, traceop_t **ops)
+{
+    size_t n;
+    int k;
+
+    pthread_mutex_lock(&s->lock);
+    if (s->held >= 0) {
+	s->full[s->held] = 0;
+	s->held = -1;
+	pthread_cond_signal(&s->drained);
+    }
+    k = s->next;
+    while (!s->full[k])
+	pthread_cond_wait(&s->filled, &s->lock);
+    if ((n = s->count[k]) > 0) {
+	s->held = k;
+	s->next = k ^ 1;
+    }
+    pthread_mutex_unlock(&s->lock);
+    *ops = s->buf[k];
+    return n;
+}
+
+/*
+ * close_trace_stream - stop the reader and free the stream
+ */
+void close_trace_stream(trace_stream_t *s)
+{
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    pthread_cond_signal(&s->drained);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->reader, NULL);
+    fclose(s->file);
+    free(s->buf[0]);
+    free(s->buf[1]);
+    free(s->rep.buf);
+    idmap_free(s->sizes);
+    free(s);
+}
+
+/*
+ * stream_reader - the reader thread: fill the buffers in turn, each as
+ *     soon as the caller has given it back, until the end of the trace
+ */
+static void *stream_reader(void *arg)
+{
+    trace_stream_t *s = (trace_stream_t *)arg;
+    size_t n;
+    int k;
+
+    for (k = 0; ; k ^= 1) {
+	pthread_mutex_lock(&s->lock);
+	while (s->full[k] && !s->stop)
+	    pthread_cond_wait(&s->drained, &s->lock);
+	pthread_mutex_unlock(&s->lock);
+	if (s->stop)
+	    break;
+
+	n = read_ops(s, s->buf[k], STREAM_CHUNK);
+
+	pthread_mutex_lock(&s->lock);
+	s->count[k] = n;
+	s->full[k] = 1;
+	pthread_cond_signal(&s->filled);
+	pthread_mutex_unlock(&s->lock);
+	if (n == 0)
+	    break;
+    }
+    return NULL;
+}
+
+/*
+ * read_ops - read up to max ops from the stream's file into ops and
+ *     return how many were read
+ */
+static size_t read_ops(trace_stream_t *s, traceop_t *ops, size_t max)
+{
+    uint64_t time, none = 0, *size;
+    size_t n, i;
+    char *msg;
+
+    if (s->binary) {
+	/* Stop at the timestamps that may follow the records */
+	if (max > s->left)
+	    max = s->left;
+	n = fread(ops, sizeof(traceop_t), max, s->file);
+	s->left -= n;
+    } else
+	for (n = 0; n < max && parse_op(&s->rep, &ops[n], &time); n++)
+	    ;
+    for (i = 0; i < n; i++, s->ops_read++) {
+	if ((msg = check_op(&ops[i], s->num_ids)) != NULL)
+	    op_error(msg, s->ops_read, s->path);
+	if (ops[i].type != FREE)
+	    size = idmap_add(s->sizes, ops[i].index);
+	else if ((size = idmap_find(s->sizes, ops[i].index)) == NULL)
+	    size = &none;
+	if ((msg = check_free(&ops[i], size)) != NULL)
+	    op_error(msg, s->ops_read, s->path);
+	if (ops[i].type == FREE && size != &none)
+	    idmap_remove(s->sizes, ops[i].index);
+    }
+    return n;
+}
+
+/*
+ * The idmap: open addressing on the id with linear probing, kept at most
+ * half full by doubling. A slot's key is its id plus one, 0 if empty.
+ */
+typedef struct {
+    uint64_t key;
+    uint64_t value;
+} idslot_t;
+
+struct idmap {
+    idslot_t *slots;
+    size_t size;        /* a power of two */
+    size_t used;
+};
+
+/* idmap_home - the slot where the search for id starts */
+static size_t idmap_home(idmap_t *m, uint64_t key)
+{
+    return (key * 0x9e3779b97f4a7c15ULL >> 32) & (m->size - 1);
+}
+
+/*
+ * idmap_new - make an empty idmap
+ */
+idmap_t *idmap_new(void)
+{
+    idmap_t *m;
+
+    if ((m = (idmap_t *)malloc(sizeof(idmap_t))) == NULL ||
+	(m->slots = (idslot_t *)calloc(IDMAP_MIN, sizeof(idslot_t))) == NULL)
+	trace_error("calloc failed in idmap_new", NULL);
+    m->size = IDMAP_MIN;
+    m->used = 0;
+    return m;
+}
+
+/*
+ * idmap_free - free an idmap
+ */
+void idmap_free(idmap_t *m)
+{
+    free(m->slots);
+    free(m);
+}
+
+/*
+ * idmap_find - return the value of id, or NULL if id is not in the map
+ */
+uint64_t *idmap_find(idmap_t *m, uint32_t id)
+{
+    uint64_t key = (uint64_t)id + 1;
+    size_t i;
+
+    for (i = idmap_home(m, key); m->slots[i].key != 0; i = (i + 1) & (m->size - 1))
+	if (m->slots[i].key == key)
+	    return &m->slots[i].value;
+    return NULL;
+}
+
+/*
+ * idmap_add - return the value of id, adding id with a value of 0 if it
+ *     is not in the map yet. The map doubles when it is half full, which
+ *     moves every value.
+ */
+uint64_t *idmap_add(idmap_t *m, uint32_t id)
+{
+    uint64_t key = (uint64_t)id + 1;
+    idslot_t *old = m->slots;
+    size_t old_size = m->size;
+    size_t i, j;
+    uint64_t *value;
+
+    if ((value = idmap_find(m, id)) != NULL)
+	return value;
+    if (2 * (m->used + 1) > m->size) {
+	if ((m->slots = (idslot_t *)calloc(2 * old_size, sizeof(idslot_t))) == NULL)
+	    trace_error("calloc failed in idmap_add", NULL);
+	m->size = 2 * old_size;
+	for (i = 0; i < old_size; i++) {
+	    if (old[i].key != 0) {
+		j = idmap_home(m, old[i].key);
+		while (m->slots[j].key != 0)
+		    j = (j + 1) & (m->size - 1);
+		m->slots[j] = old[i];
+	    }
+	}
+	free(old);
+    }
+    for (i = idmap_home(m, key); m->slots[i].key != 0; i = (i + 1) & (m->size - 1))
+	;
+    m->slots[i].key = key;
+    m->slots[i].value = 0;
+    m->used++;
+    return &m->slots[i].value;
+}
+
+/*
+ * idmap_remove - remove id from the map, moving up the later slots of
+ *     its run that would no longer be found past the hole
+ */
+void idmap_remove(idmap_t *m, uint32_t id)
+{
+    uint64_t key = (uint64_t)id + 1;
+    size_t mask = m->size - 1;
+    size_t hole, i, home;
+
+    for (hole = idmap_home(m, key); m->slots[hole].key != key; hole = (hole + 1) & mask)
+	if (m->slots[hole].key == 0)
+	    return;
+    m->slots[hole].key = 0;
+    m->used--;
+    for (i = (hole + 1) & mask; m->slots[i].key != 0; i = (i + 1) & mask) {
+	home = idmap_home(m, m->slots[i].key);
+	/* Move slot i into the hole unless its home lies in (hole, i] */
+	if (((i - home) & mask) >= ((i - hole) & mask)) {
+	    m->slots[hole] = m->slots[i];
+	    m->slots[i].key = 0;
+	    hole = i;
+	}
+    }
+}
+
+/*
+ * trace_error - Report a Unix-style error about a trace file and exit
+ */
+static void trace_error(char *msg, char *path)
+{
+    if (path != NULL)
+	printf("%s %s: %s\n", msg, path, strerror(errno));
+    else
+	printf("%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
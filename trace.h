@@ -0,0 +1,83 @@
+/*
+ * trace.h - Malloc lab trace files. A trace is read from the text .rep
+ * format, or mapped straight into memory from the binary format: a
+ * tracehdr_t followed by num_ops traceop_t records, in host byte order,
+ * and then, if the trace has TRACE_TIMES, num_ops uint64_t timestamps.
+ *
+ * A v2 .rep trace starts with a line "v2" followed by the names of its
+ * optional columns, "thread" and/or "time", which then end every request
+ * line in that order. A trace with no version line is v1 and has none.
+ */
+#include <stdint.h>
+#include <stddef.h>
+
+/* Request types */
+enum {ALLOC, FREE, REALLOC, CALLOC, MEMALIGN};
+
+/* Characterizes a single trace operation (allocator request), as stored in a binary trace */
+typedef struct {
+    uint64_t size;      /* byte size of alloc/realloc request, or of a sized free */
+    uint32_t index;     /* index for free() to use later */
+    uint8_t type;       /* type of request */
+    uint8_t align_log;  /* log2 of the payload alignment of memalign request */
+    uint16_t thread;    /* thread that made the request, 0 without TRACE_THREADS */
+} traceop_t;
+
+/* Payload alignment of a memalign request */
+#define OP_ALIGN(op) ((size_t)1 << (op).align_log)
+
+/* Header of a binary trace file */
+typedef struct {
+    uint32_t magic;          /* TRACE_MAGIC */
+    uint32_t version;        /* TRACE_VERSION */
+    uint32_t num_ids;        /* number of alloc/realloc ids */
+    uint32_t weight;         /* weight for this trace (unused) */
+    uint64_t num_ops;        /* number of traceop_t records after the header */
+    uint64_t sugg_heapsize;  /* suggested heap size (unused) */
+    uint32_t flags;          /* optional columns, since version 2 */
+    uint32_t unused;         /* always 0 */
+} tracehdr_t;
+
+#define TRACE_MAGIC 0x4d4d5254  /* "TRMM" read as a little-endian word */
+#define TRACE_VERSION 2
+#define TRACE_HDR_V1 offsetof(tracehdr_t, flags)  /* header size of version 1 */
+
+/* Optional columns of a trace */
+#define TRACE_THREADS 0x1  /* the thread id of each op */
+#define TRACE_TIMES 0x2    /* a timestamp for each op, in ns */
+
+/* Holds the information for one trace file*/
+typedef struct {
+    int sugg_heapsize;   /* suggested heap size (unused) */
+    int num_ids;         /* number of alloc/realloc ids */
+    int num_ops;         /* number of distinct requests */
+    int weight;          /* weight for this trace (unused) */
+    traceop_t *ops;      /* array of requests */
+    char **blocks;       /* array of ptrs returned by malloc/realloc... */
+    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    int flags;           /* optional columns (TRACE_THREADS, TRACE_TIMES) */
+    uint64_t *times;     /* timestamp of each op if TRACE_TIMES, else NULL */
+    void *map;           /* mapping of a binary trace file, NULL for .rep... */
+    size_t map_size;     /* ... and its length */
+} trace_t;
+
+extern trace_t *read_trace(char *tracedir, char *filename);
+extern void free_trace(trace_t *trace);
+extern void write_trace_rep(trace_t *trace, char *path);
+extern void write_trace_bin(trace_t *trace, char *path);
+
+/* A trace read in chunks by a reader thread, for traces too big to load */
+typedef struct trace_stream trace_stream_t;
+
+extern trace_stream_t *open_trace_stream(char *path, uint64_t *num_ids, uint64_t *num_ops);
+extern size_t next_trace_chunk(trace_stream_t *s, traceop_t **ops);
+extern void close_trace_stream(trace_stream_t *s);
+
+/* A map from the ids live in a stream to a value each, sized by the live ids */
+typedef struct idmap idmap_t;
+
+extern idmap_t *idmap_new(void);
+extern void idmap_free(idmap_t *m);
+extern uint64_t *idmap_find(idmap_t *m, uint32_t id);
+extern uint64_t *idmap_add(idmap_t *m, uint32_t id);
+extern void idmap_remove(idmap_t *m, uint32_t id);
@@ -0,0 +1,29 @@
+/*
+ * tracecvt.c - Convert a malloc lab trace between the text .rep format
+ *              and the binary format that mdriver maps without parsing.
+ *
+ * usage: tracecvt <in> <out>
+ * A .rep input is written out binary, a binary input as .rep.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "trace.h"
+
+int main(int argc, char **argv)
+{
+    trace_t *trace;
+
+    if (argc != 3) {
+	fprintf(stderr, "usage: %s <in> <out>\n", argv[0]);
+	fprintf(stderr, "Converts a .rep trace to binary, or a binary trace to .rep.\n");
+	exit(1);
+    }
+    trace = read_trace("", argv[1]);
+    if (trace->map != NULL)
+	write_trace_rep(trace, argv[2]);
+    else
+	write_trace_bin(trace, argv[2]);
+    free_trace(trace);
+    exit(0);
+}
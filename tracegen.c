@@ -0,0 +1,784 @@
+/*
+ * tracegen.c - Generate synthetic traces from a workload spec, at any
+ *              scale, for stressing mm with far more ops than the
+ *              recorded traces have.
+ *
+ * usage: tracegen [-s <seed>] [-n <ops>] <spec|preset> <out>
+ *        tracegen -l
+ * The trace is written binary if out ends in .bin, and as .rep otherwise.
+ * -s overrides the seed of the spec, -n scales its phases to about <ops>
+ * ops in all, and -l prints the presets.
+ *
+ * A spec is a file, or the name of a preset, of lines like these:
+ *
+ *     # comment
+ *     seed 42
+ *     phase <name> <ops> [<key>=<value> ...]
+ *
+ * The phases run in order, each for <ops> ops, and each starts with the
+ * settings of the one before it, so a phase lists only what changes:
+ *
+ *     size=D      bytes asked for by an allocation
+ *     life=D      ops from an allocation to its free
+ *     max=N       largest block, in bytes
+ *     realloc=P   share of blocks that grow by a chain of reallocs...
+ *     chain=D     ... of this many reallocs...
+ *     gap=D       ... this many ops apart...
+ *     grow=D      ... each multiplying the size by this factor
+ *     calloc=P    share of allocations made by calloc...
+ *     memalign=P  ... and by memalign...
+ *     align=D     ... to this alignment, rounded up to a power of two
+ *     sized=P     share of frees that pass the block size
+ *     threads=N   threads to spread the allocations over (v2 thread column)
+ *     remote=P    share of frees made by another thread than the allocation
+ *     maxlive=N   live bytes not to exceed, freeing the blocks due first
+ *     drain=0|1   free the blocks the phase allocated when it ends
+ *     repeat=N    run the phase N times over
+ *
+ * where P is a probability, N a number and D a distribution: const:V,
+ * uniform:A:B, pow2:A:B (a power of two between A and B), exp:MEAN,
+ * lognormal:MEDIAN:SIGMA, choice:V@W,V@W,... (V with weight W) or never
+ * (for life). Numbers take a K, M or G suffix (powers of 1024).
+ *
+ * Each op is the earliest due free or realloc if there is one, and an
+ * allocation otherwise, so frees and allocations balance out whatever
+ * the lifetimes; the frees of drain=1 and of the end of the trace come
+ * on top of the phase's ops. A block is freed at the end of its life or
+ * of its realloc chain, whichever is later, and every block still live
+ * at the end of the trace is freed then, as in the -bal traces.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define MAX_PHASES 64
+#define NEVER UINT64_MAX    /* due time of a block that is never freed */
+
+/* A distribution of values */
+typedef struct {
+    enum {D_CONST, D_UNIFORM, D_POW2, D_EXP, D_LOGNORMAL, D_CHOICE, D_NEVER} kind;
+    double a, b;
+    int n;              /* choices... */
+    double *vals;       /* ... their values... */
+    double *cum;        /* ... and cumulative weights */
+} dist_t;
+
+/* The settings of a phase */
+typedef struct {
+    char name[32];
+    uint64_t ops;
+    int repeat;
+    dist_t size, life, chain, gap, grow, align;
+    double realloc, calloc, memalign, sized, remote;
+    int threads;
+    uint64_t max, maxlive;
+    int drain;
+} phase_t;
+
+/* A live block */
+typedef struct {
+    uint64_t size;
+    uint64_t free_at;   /* op number at which it is due to be freed */
+    int reallocs;       /* reallocs left in its chain */
+    uint16_t thread;
+    uint16_t phase;
+    double grow;        /* factor of its reallocs */
+} block_t;
+
+/* The next free or realloc of a live block, in a min-heap by time */
+typedef struct {
+    uint64_t time;
+    uint32_t id;
+} event_t;
+
+/* A built-in spec */
+typedef struct {
+    char *name;
+    char *desc;
+    char *spec;
+} preset_t;
+
+static preset_t presets[] = {
+    {"server", "request handling: sessions, request buffers, a traffic spike",
+     "seed 1\n"
+     "# sessions and config that live for the whole run\n"
+     "phase startup 10K size=lognormal:128:1 life=never max=64K threads=8\n"
+     "# request headers and bodies, built up by realloc and often freed by\n"
+     "# another worker than the one that read them\n"
+     "phase steady 2M size=choice:32@30,64@25,128@15,512@10,4K@8,16K@2 "
+     "life=exp:2K realloc=0.1 chain=uniform:1:5 gap=exp:50 grow=const:2 "
+     "remote=0.3 sized=0.5\n"
+     "phase spike 500K life=exp:20K maxlive=8M\n"
+     "phase cooldown 500K life=exp:2K maxlive=0\n"},
+    {"compiler", "cccp/cp-decl: symbol tables plus per-function scratch",
+     "seed 2\n"
+     "# declarations, kept to the end like cp-decl's\n"
+     "phase decls 100K size=choice:16@20,24@30,32@20,40@15,64@10,256@5 "
+     "life=never max=4K\n"
+     "# a function at a time: trees and strings freed when it is done,\n"
+     "# obstack-like buffers growing by realloc\n"
+     "phase function 50K repeat=40 size=lognormal:24:0.8 life=exp:20K "
+     "realloc=0.05 chain=uniform:1:8 gap=exp:200 grow=uniform:1.2:2 drain=1\n"
+     "# macro expansion like cccp's: short-lived strings\n"
+     "phase macros 500K size=lognormal:40:1 life=exp:64 realloc=0.02 drain=0\n"},
+    {"cache", "key-value cache: fill, then evict on a byte budget",
+     "seed 3\n"
+     "phase fill 300K size=lognormal:300:1.5 max=256K life=never maxlive=8M "
+     "memalign=0.02 align=pow2:16:4K calloc=0.1\n"
+     "# updates resize values in place; entries expire or get evicted\n"
+     "phase serve 3M life=exp:400K realloc=0.2 chain=uniform:1:3 gap=exp:10K "
+     "grow=uniform:0.5:2\n"
+     "phase churn 1M size=lognormal:4K:1 life=exp:50K\n"},
+};
+
+#define NUM_PRESETS (int)(sizeof(presets) / sizeof(presets[0]))
+
+static phase_t phases[MAX_PHASES];
+static int num_phases;
+static uint64_t seed = 1;
+static uint64_t rng;
+
+static trace_t trace;
+static size_t max_ops;
+static block_t *blocks;
+static size_t max_blocks;
+static event_t *heap;
+static size_t heap_size;
+static uint64_t live_bytes;
+static uint64_t peak_bytes, phase_peak;    /* most live bytes in all, and in the phase */
+static uint64_t t;          /* ops so far */
+
+static char *read_spec(char *name);
+static void parse_spec(char *text, char *name);
+static int parse_setting(phase_t *p, char *key, char *val);
+static void parse_dist(dist_t *d, char *text);
+static double parse_value(char *text, char **end);
+static void run_phase(phase_t *p, int index);
+static void alloc_block(phase_t *p, int index);
+static void next_event(void);
+static void free_block(uint32_t id);
+static void drain_phase(int index);
+static void add_op(int type, uint32_t id, uint64_t size, uint16_t thread);
+static void add_live(uint64_t old_size, uint64_t new_size);
+static void heap_push(uint64_t time, uint32_t id);
+static event_t heap_pop(void);
+static void heap_down(size_t i);
+static int event_less(event_t *x, event_t *y);
+static int id_desc(const void *a, const void *b);
+static double sample(dist_t *d);
+static uint64_t sample_size(dist_t *d, uint64_t max);
+static double uniform(void);
+static int chance(double p);
+static uint64_t next_random(void);
+static void app_error(char *msg);
+
+
+int main(int argc, char **argv)
+{
+    uint64_t total_ops = 0, want_ops = 0, user_seed = 0;
+    int set_seed = 0;
+    char *spec;
+    size_t len;
+    int c, i, k;
+
+    while ((c = getopt(argc, argv, "s:n:lh")) != EOF) {
+	switch (c) {
+	case 's':
+	    user_seed = strtoull(optarg, NULL, 0);
+	    set_seed = 1;
+	    break;
+	case 'n':
+	    want_ops = (uint64_t)parse_value(optarg, NULL);
+	    break;
+	case 'l':
+	    for (i = 0; i < NUM_PRESETS; i++)
+		printf("%s: %s\n%s\n", presets[i].name, presets[i].desc,
+		       presets[i].spec);
+	    exit(0);
+	default:
+	    fprintf(stderr, "usage: %s [-s <seed>] [-n <ops>] <spec|preset> <out>\n",
+		    argv[0]);
+	    fprintf(stderr, "       %s -l\n", argv[0]);
+	    fprintf(stderr, "Generates a trace, binary if <out> ends in .bin.\n");
+	    exit(1);
+	}
+    }
+    if (argc - optind != 2)
+	app_error("usage: tracegen [-s <seed>] [-n <ops>] <spec|preset> <out>");
+
+    spec = read_spec(argv[optind]);
+    parse_spec(spec, argv[optind]);
+    rng = set_seed ? user_seed : seed;
+
+    /* Scale the phases to the ops asked for */
+    for (i = 0; i < num_phases; i++)
+	total_ops += phases[i].ops * phases[i].repeat;
+    if (want_ops > 0 && total_ops > 0)
+	for (i = 0; i < num_phases; i++) {
+	    phases[i].ops = (double)phases[i].ops * want_ops / total_ops;
+	    if (phases[i].ops == 0)
+		phases[i].ops = 1;
+	}
+
+    trace.weight = 1;
+    for (i = 0; i < num_phases; i++)
+	if (phases[i].threads > 1)
+	    trace.flags = TRACE_THREADS;
+    for (i = 0; i < num_phases; i++) {
+	phase_peak = live_bytes;
+	for (k = 0; k < phases[i].repeat; k++) {
+	    run_phase(&phases[i], i);
+	    if (phases[i].drain)
+		drain_phase(i);
+	}
+	printf("%-12s ends at op %10d, peak of %llu live bytes\n", phases[i].name,
+	       trace.num_ops, (unsigned long long)phase_peak);
+    }
+    while (heap_size > 0)
+	free_block(heap_pop().id);
+
+    len = strlen(argv[optind + 1]);
+    if (len > 4 && strcmp(argv[optind + 1] + len - 4, ".bin") == 0)
+	write_trace_bin(&trace, argv[optind + 1]);
+    else
+	write_trace_rep(&trace, argv[optind + 1]);
+    printf("%d ops on %d ids, peak of %llu live bytes\n", trace.num_ops,
+	   trace.num_ids, (unsigned long long)peak_bytes);
+    exit(0);
+}
+
+/*
+ * read_spec - return the text of the preset called name, or else of the
+ *     spec file at name
+ */
+static char *read_spec(char *name)
+{
+    FILE *f;
+    char *text;
+    long size;
+    int i;
+
+    for (i = 0; i < NUM_PRESETS; i++)
+	if (strcmp(name, presets[i].name) == 0)
+	    return presets[i].spec;
+    if ((f = fopen(name, "r")) == NULL) {
+	fprintf(stderr, "No preset or spec file called %s\n", name);
+	exit(1);
+    }
+    if (fseek(f, 0, SEEK_END) < 0 || (size = ftell(f)) < 0)
+	app_error("Could not read the spec");
+    rewind(f);
+    if ((text = (char *)malloc(size + 1)) == NULL)
+	app_error("malloc failed in read_spec");
+    if (fread(text, 1, size, f) != (size_t)size)
+	app_error("Could not read the spec");
+    text[size] = '\0';
+    fclose(f);
+    return text;
+}
+
+/*
+ * parse_spec - parse the text of a spec into phases and the seed. The
+ *     text is split up in place.
+ */
+static void parse_spec(char *text, char *name)
+{
+    char *line, *next, *word, *val, *end;
+    phase_t *p;
+    int lineno = 0;
+
+    /* Defaults that the first phase starts from */
+    p = &phases[0];
+    memset(p, 0, sizeof(*p));
+    parse_dist(&p->size, "uniform:1:256");
+    parse_dist(&p->life, "exp:1K");
+    parse_dist(&p->chain, "uniform:1:4");
+    parse_dist(&p->gap, "exp:100");
+    parse_dist(&p->grow, "const:2");
+    parse_dist(&p->align, "const:64");
+    p->threads = 1;
+    p->max = 1 << 20;
+
+    text = strdup(text);
+    for (line = text; line != NULL; line = next) {
+	lineno++;
+	if ((next = strchr(line, '\n')) != NULL)
+	    *next++ = '\0';
+	if ((end = strchr(line, '#')) != NULL)
+	    *end = '\0';
+	if ((word = strtok(line, " \t\r")) == NULL)
+	    continue;
+
+	if (strcmp(word, "seed") == 0 && (val = strtok(NULL, " \t\r")) != NULL) {
+	    seed = strtoull(val, NULL, 0);
+	    continue;
+	}
+	if (strcmp(word, "phase") != 0 || num_phases == MAX_PHASES)
+	    goto bad;
+	p = &phases[num_phases];
+	if (num_phases > 0)
+	    *p = phases[num_phases - 1];
+	p->repeat = 1;
+	p->drain = 0;
+	if ((word = strtok(NULL, " \t\r")) == NULL)
+	    goto bad;
+	snprintf(p->name, sizeof(p->name), "%s", word);
+	if ((word = strtok(NULL, " \t\r")) == NULL)
+	    goto bad;
+	p->ops = (uint64_t)parse_value(word, &end);
+	if (*end != '\0')
+	    goto bad;
+	while ((word = strtok(NULL, " \t\r")) != NULL) {
+	    if ((val = strchr(word, '=')) == NULL)
+		goto bad;
+	    *val++ = '\0';
+	    if (!parse_setting(p, word, val))
+		goto bad;
+	}
+	num_phases++;
+    }
+    if (num_phases == 0) {
+	fprintf(stderr, "Spec %s has no phases\n", name);
+	exit(1);
+    }
+    return;
+
+ bad:
+    fprintf(stderr, "Bad line %d of spec %s\n", lineno, name);
+    exit(1);
+}
+
+/*
+ * parse_setting - set key of phase p to val. Returns 0 for an unknown key.
+ */
+static int parse_setting(phase_t *p, char *key, char *val)
+{
+    struct {char *key; dist_t *dist;} dists[] = {
+	{"size", &p->size}, {"life", &p->life}, {"chain", &p->chain},
+	{"gap", &p->gap}, {"grow", &p->grow}, {"align", &p->align}};
+    struct {char *key; double *share;} shares[] = {
+	{"realloc", &p->realloc}, {"calloc", &p->calloc},
+	{"memalign", &p->memalign}, {"sized", &p->sized}, {"remote", &p->remote}};
+    double v;
+    char *end;
+    int i;
+
+    for (i = 0; i < (int)(sizeof(dists) / sizeof(dists[0])); i++)
+	if (strcmp(key, dists[i].key) == 0) {
+	    parse_dist(dists[i].dist, val);
+	    return 1;
+	}
+    v = parse_value(val, &end);
+    if (*end != '\0' || v < 0)
+	return 0;
+    for (i = 0; i < (int)(sizeof(shares) / sizeof(shares[0])); i++)
+	if (strcmp(key, shares[i].key) == 0) {
+	    *shares[i].share = v;
+	    return v <= 1;
+	}
+    if (strcmp(key, "threads") == 0)
+	p->threads = v;
+    else if (strcmp(key, "max") == 0)
+	p->max = v;
+    else if (strcmp(key, "maxlive") == 0)
+	p->maxlive = v;
+    else if (strcmp(key, "drain") == 0)
+	p->drain = v != 0;
+    else if (strcmp(key, "repeat") == 0)
+	p->repeat = v;
+    else
+	return 0;
+    return p->threads >= 1 && p->threads <= 0x10000 && p->max >= 1 &&
+	p->repeat >= 1;
+}
+
+/*
+ * parse_dist - parse the text of a distribution into d
+ */
+static void parse_dist(dist_t *d, char *text)
+{
+    static struct {char *name; int kind; int args;} kinds[] = {
+	{"const:", D_CONST, 1}, {"uniform:", D_UNIFORM, 2}, {"pow2:", D_POW2, 2},
+	{"exp:", D_EXP, 1}, {"lognormal:", D_LOGNORMAL, 2}, {"choice:", D_CHOICE, 0}};
+    char *p, *end;
+    double w, sum = 0;
+    size_t len;
+    int i;
+
+    memset(d, 0, sizeof(*d));
+    if (strcmp(text, "never") == 0) {
+	d->kind = D_NEVER;
+	return;
+    }
+    for (i = 0; i < (int)(sizeof(kinds) / sizeof(kinds[0])); i++) {
+	len = strlen(kinds[i].name);
+	if (strncmp(text, kinds[i].name, len) == 0)
+	    break;
+    }
+    if (i == (int)(sizeof(kinds) / sizeof(kinds[0])))
+	goto bad;
+    d->kind = kinds[i].kind;
+    p = text + len;
+
+    if (d->kind == D_CHOICE) {
+	d->n = 1;
+	for (end = p; *end != '\0'; end++)
+	    d->n += *end == ',';
+	if ((d->vals = (double *)malloc(d->n * sizeof(double))) == NULL ||
+	    (d->cum = (double *)malloc(d->n * sizeof(double))) == NULL)
+	    app_error("malloc failed in parse_dist");
+	for (i = 0; i < d->n; i++) {
+	    d->vals[i] = parse_value(p, &end);
+	    w = 1;
+	    if (*end == '@')
+		w = parse_value(end + 1, &end);
+	    if ((*end != ',' && *end != '\0') || w < 0)
+		goto bad;
+	    d->cum[i] = sum += w;
+	    p = end + 1;
+	}
+	if (sum <= 0)
+	    goto bad;
+	return;
+    }
+    d->a = parse_value(p, &end);
+    if (kinds[i].args == 2) {
+	if (*end != ':')
+	    goto bad;
+	d->b = parse_value(end + 1, &end);
+	if (d->kind != D_LOGNORMAL && d->b < d->a)
+	    goto bad;
+    }
+    if (*end == '\0' && !(d->kind == D_POW2 &&
+			   (d->a <= 0 || ceil(log2(d->a)) > floor(log2(d->b)))))
+	return;
+
+ bad:
+    fprintf(stderr, "Bad distribution %s\n", text);
+    exit(1);
+}
+
+/*
+ * parse_value - parse a number with an optional K, M or G suffix, setting
+ *     end (if not NULL) past it
+ */
+static double parse_value(char *text, char **end)
+{
+    char *e;
+    double v;
+
+    v = strtod(text, &e);
+    if (e == text)
+	app_error("Bad number in spec");
+    switch (*e) {
+    case 'K': case 'k': v *= 1 << 10; e++; break;
+    case 'M': case 'm': v *= 1 << 20; e++; break;
+    case 'G': case 'g': v *= 1 << 30; e++; break;
+    }
+    if (end != NULL)
+	*end = e;
+    return v;
+}
+
+/*
+ * run_phase - generate the ops of one run of phase p
+ */
+static void run_phase(phase_t *p, int index)
+{
+    uint64_t end = t + p->ops;
+
+    while (t < end) {
+	if (heap_size > 0 && heap[0].time <= t)
+	    next_event();
+	else
+	    alloc_block(p, index);
+    }
+}
+
+/*
+ * alloc_block - allocate a new block, first freeing the blocks due first
+ *     if it would take the live bytes over maxlive
+ */
+static void alloc_block(phase_t *p, int index)
+{
+    uint32_t id = trace.num_ids;
+    block_t *b;
+    uint64_t size, life, gap;
+    int align_log;
+
+    size = sample_size(&p->size, p->max);
+    if (p->maxlive > 0 && heap_size > 0 && live_bytes + size > p->maxlive) {
+	free_block(heap_pop().id);
+	return;
+    }
+    if ((size_t)id == max_blocks) {
+	max_blocks = max_blocks ? 2 * max_blocks : 1 << 16;
+	if ((blocks = (block_t *)realloc(blocks, max_blocks * sizeof(block_t))) == NULL ||
+	    (heap = (event_t *)realloc(heap, max_blocks * sizeof(event_t))) == NULL)
+	    app_error("malloc failed in alloc_block");
+    }
+    trace.num_ids++;
+    b = &blocks[id];
+    b->size = size;
+    b->thread = p->threads > 1 ? next_random() % p->threads : 0;
+    b->phase = index;
+    b->reallocs = 0;
+    b->grow = 1;
+
+    if (chance(p->memalign)) {
+	align_log = ceil(log2(sample(&p->align)));
+	add_op(MEMALIGN, id, size, b->thread);
+	trace.ops[trace.num_ops - 1].align_log = align_log > 0 ? align_log : 0;
+    } else
+	add_op(chance(p->calloc) ? CALLOC : ALLOC, id, size, b->thread);
+    add_live(0, size);
+
+    life = p->life.kind == D_NEVER ? NEVER : (uint64_t)sample(&p->life);
+    b->free_at = life == NEVER ? NEVER : t + (life > 0 ? life : 1);
+    if (chance(p->realloc)) {
+	b->reallocs = sample(&p->chain);
+	b->grow = sample(&p->grow);
+    }
+    if (b->reallocs > 0) {
+	gap = sample(&p->gap);
+	heap_push(t + (gap > 0 ? gap : 1), id);
+    } else
+	heap_push(b->free_at, id);
+}
+
+/*
+ * next_event - make the earliest due op of a live block: the next realloc
+ *     of its chain, or its free
+ */
+static void next_event(void)
+{
+    event_t e = heap_pop();
+    block_t *b = &blocks[e.id];
+    phase_t *p = &phases[b->phase];
+    uint64_t size, gap;
+
+    if (b->reallocs == 0) {
+	free_block(e.id);
+	return;
+    }
+    size = b->size * b->grow;
+    size = size < 1 ? 1 : size > p->max ? p->max : size;
+    add_live(b->size, size);
+    b->size = size;
+    add_op(REALLOC, e.id, size, b->thread);
+    if (--b->reallocs > 0) {
+	gap = sample(&p->gap);
+	heap_push(t + (gap > 0 ? gap : 1), e.id);
+    } else
+	heap_push(b->free_at > t ? b->free_at : t + 1, e.id);
+}
+
+/*
+ * free_block - free block id, which is no longer in the heap
+ */
+static void free_block(uint32_t id)
+{
+    block_t *b = &blocks[id];
+    phase_t *p = &phases[b->phase];
+    uint16_t thread = b->thread;
+
+    if (p->threads > 1 && chance(p->remote))
+	thread = (thread + 1 + next_random() % (p->threads - 1)) % p->threads;
+    add_op(FREE, id, chance(p->sized) ? b->size : 0, thread);
+    add_live(b->size, 0);
+}
+
+/*
+ * drain_phase - free the live blocks of phase index, newest first
+ */
+static void drain_phase(int index)
+{
+    uint32_t *ids;
+    size_t i, n = 0, kept = 0;
+
+    if (heap_size == 0)
+	return;
+    if ((ids = (uint32_t *)malloc(heap_size * sizeof(uint32_t))) == NULL)
+	app_error("malloc failed in drain_phase");
+    for (i = 0; i < heap_size; i++)
+	if (blocks[heap[i].id].phase == index)
+	    ids[n++] = heap[i].id;
+	else
+	    heap[kept++] = heap[i];
+    heap_size = kept;
+    for (i = heap_size / 2; i-- > 0; )
+	heap_down(i);
+    qsort(ids, n, sizeof(uint32_t), id_desc);
+    for (i = 0; i < n; i++)
+	free_block(ids[i]);
+    free(ids);
+}
+
+/*
+ * add_op - append an op to the trace, which is one more op of time
+ */
+static void add_op(int type, uint32_t id, uint64_t size, uint16_t thread)
+{
+    traceop_t *op;
+
+    if ((size_t)trace.num_ops == max_ops) {
+	max_ops = max_ops ? 2 * max_ops : 1 << 16;
+	if (max_ops > 0x7fffffff)
+	    app_error("Trace has too many ops");
+	if ((trace.ops = (traceop_t *)realloc(trace.ops,
+					      max_ops * sizeof(traceop_t))) == NULL)
+	    app_error("malloc failed in add_op");
+    }
+    op = &trace.ops[trace.num_ops++];
+    op->type = type;
+    op->index = id;
+    op->size = size;
+    op->align_log = 0;
+    op->thread = thread;
+    t++;
+}
+
+/*
+ * add_live - account for a live block going from old_size to new_size bytes
+ */
+static void add_live(uint64_t old_size, uint64_t new_size)
+{
+    live_bytes += new_size - old_size;
+    if (live_bytes > peak_bytes)
+	peak_bytes = live_bytes;
+    if (live_bytes > phase_peak)
+	phase_peak = live_bytes;
+}
+
+/*
+ * The heap of events
+ */
+static void heap_push(uint64_t time, uint32_t id)
+{
+    size_t i = heap_size++;
+    event_t e = {time, id};
+
+    while (i > 0 && event_less(&e, &heap[(i - 1) / 2])) {
+	heap[i] = heap[(i - 1) / 2];
+	i = (i - 1) / 2;
+    }
+    heap[i] = e;
+}
+
+static event_t heap_pop(void)
+{
+    event_t top = heap[0];
+
+    heap[0] = heap[--heap_size];
+    heap_down(0);
+    return top;
+}
+
+static void heap_down(size_t i)
+{
+    event_t e = heap[i];
+    size_t child;
+
+    while ((child = 2 * i + 1) < heap_size) {
+	if (child + 1 < heap_size && event_less(&heap[child + 1], &heap[child]))
+	    child++;
+	if (!event_less(&heap[child], &e))
+	    break;
+	heap[i] = heap[child];
+	i = child;
+    }
+    heap[i] = e;
+}
+
+/* event_less - is x due before y? Ties go to the older block. */
+static int event_less(event_t *x, event_t *y)
+{
+    return x->time < y->time || (x->time == y->time && x->id < y->id);
+}
+
+/* id_desc - qsort comparator for ids, largest first */
+static int id_desc(const void *a, const void *b)
+{
+    uint32_t x = *(uint32_t *)a, y = *(uint32_t *)b;
+
+    return (x < y) - (x > y);
+}
+
+/*
+ * Random numbers
+ */
+
+/* sample - draw a value from distribution d */
+static double sample(dist_t *d)
+{
+    double u;
+    int i;
+
+    switch (d->kind) {
+    case D_CONST:
+	return d->a;
+    case D_UNIFORM:
+	return d->a + (d->b - d->a) * uniform();
+    case D_POW2:
+	/* A power of two between ceil(log2 a) and floor(log2 b), uniformly */
+	u = ceil(log2(d->a));
+	u += floor((floor(log2(d->b)) - u + 1) * uniform());
+	return ldexp(1, (int)u);
+    case D_EXP:
+	return -d->a * log(1 - uniform());
+    case D_LOGNORMAL:
+	/* Box-Muller, with u in (0, 1] */
+	u = 1 - uniform();
+	return d->a * exp(d->b * sqrt(-2 * log(u)) * cos(2 * M_PI * uniform()));
+    case D_CHOICE:
+	u = uniform() * d->cum[d->n - 1];
+	for (i = 0; i < d->n - 1 && d->cum[i] <= u; i++)
+	    ;
+	return d->vals[i];
+    default:
+	return 0;
+    }
+}
+
+/* sample_size - draw a size in [1, max] from distribution d */
+static uint64_t sample_size(dist_t *d, uint64_t max)
+{
+    double v = sample(d);
+
+    return v < 1 ? 1 : v > max ? max : (uint64_t)v;
+}
+
+/* uniform - a random number in [0, 1) */
+static double uniform(void)
+{
+    return (next_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* chance - true with probability p */
+static int chance(double p)
+{
+    return p > 0 && uniform() < p;
+}
+
+/* next_random - splitmix64, so a seed gives the same trace everywhere */
+static uint64_t next_random(void)
+{
+    uint64_t z = (rng += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/*
+ * app_error - Report an arbitrary application error and exit
+ */
+static void app_error(char *msg)
+{
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+}
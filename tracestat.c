@@ -0,0 +1,280 @@
+/*
+ * tracestat.c - Profile a malloc lab trace, to choose mm's size classes,
+ *               thresholds and CHUNKSIZE from what the trace does.
+ *
+ * usage: tracestat [-c] [-p <points>] <trace>
+ * Reads a trace of either format and reports
+ *   - the ops of each type,
+ *   - per power-of-two size class (the classes of mm's free lists): the
+ *     allocations and reallocs asking for a size in it, the frees of
+ *     blocks in it, and its share of all ops,
+ *   - the lifetimes of blocks, in ops from allocation to free,
+ *   - the lengths of realloc chains, the reallocs a block gets before
+ *     it is freed,
+ *   - the peak of live payload bytes, and the live bytes over the trace
+ *     at <points> points (20 by default), with the peak in between.
+ * -c prints it all as CSV, each row starting with the name of its table.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define NUM_CLASSES 65      /* class k holds values in (2^(k-1), 2^k] */
+
+/* Counts per size class */
+typedef struct {
+    uint64_t allocs;    /* alloc, calloc and memalign requests */
+    uint64_t reallocs;  /* realloc requests for a size in the class */
+    uint64_t frees;     /* frees of blocks in the class */
+    uint64_t bytes;     /* bytes asked for by allocs and reallocs */
+} class_t;
+
+static class_t classes[NUM_CLASSES];
+static uint64_t lifetimes[NUM_CLASSES];   /* freed blocks per class of lifetime */
+static uint64_t chains[NUM_CLASSES];      /* freed blocks per class of chain length */
+static uint64_t type_ops[MEMALIGN + 1];
+static uint64_t unfreed;                  /* blocks still live at the end */
+static int csv;
+
+static int class_of(uint64_t v);
+static void print_classes(char *table, char *unit, uint64_t *counts);
+static void app_error(char *msg);
+
+
+int main(int argc, char **argv)
+{
+    static char *type_names[] = {"alloc", "free", "realloc", "calloc", "memalign"};
+    trace_t *trace;
+    traceop_t *op;
+    uint64_t *sizes, *born, *reallocs;
+    uint64_t *last_op, *live_at, *peak_in;  /* the series, per point */
+    uint64_t live = 0, peak = 0, peak_op = 0, window_peak = 0, next_point;
+    uint64_t num_ops, i, c;
+    int points = 20, point = 0, ch;
+    char *name;
+
+    while ((ch = getopt(argc, argv, "cp:h")) != EOF) {
+	switch (ch) {
+	case 'c':
+	    csv = 1;
+	    break;
+	case 'p':
+	    if ((points = atoi(optarg)) <= 0)
+		app_error("-p requires a positive number of points");
+	    break;
+	default:
+	    fprintf(stderr, "usage: %s [-c] [-p <points>] <trace>\n", argv[0]);
+	    fprintf(stderr, "Reports the sizes, lifetimes and live bytes of a trace.\n");
+	    exit(1);
+	}
+    }
+    if (argc - optind != 1)
+	app_error("usage: tracestat [-c] [-p <points>] <trace>");
+    name = argv[optind];
+    trace = read_trace("", name);
+    num_ops = trace->num_ops;
+
+    /* Per id: payload size, op of the allocation (0 if not live), reallocs */
+    if ((sizes = (uint64_t *)calloc(trace->num_ids + 1, sizeof(uint64_t))) == NULL ||
+	(born = (uint64_t *)calloc(trace->num_ids + 1, sizeof(uint64_t))) == NULL ||
+	(reallocs = (uint64_t *)calloc(trace->num_ids + 1, sizeof(uint64_t))) == NULL)
+	app_error("calloc failed in tracestat");
+    if ((last_op = (uint64_t *)malloc(points * sizeof(uint64_t))) == NULL ||
+	(live_at = (uint64_t *)malloc(points * sizeof(uint64_t))) == NULL ||
+	(peak_in = (uint64_t *)malloc(points * sizeof(uint64_t))) == NULL)
+	app_error("malloc failed in tracestat");
+
+    next_point = num_ops / points;
+    for (i = 0; i < num_ops; i++) {
+	op = &trace->ops[i];
+	type_ops[op->type]++;
+	switch (op->type) {
+	case ALLOC:
+	case CALLOC:
+	case MEMALIGN:
+	    c = class_of(op->size);
+	    classes[c].allocs++;
+	    classes[c].bytes += op->size;
+	    if (born[op->index] != 0) {     /* an id reused without a free */
+		unfreed++;
+		live -= sizes[op->index];
+	    }
+	    sizes[op->index] = op->size;
+	    born[op->index] = i + 1;
+	    reallocs[op->index] = 0;
+	    live += op->size;
+	    break;
+	case REALLOC:
+	    c = class_of(op->size);
+	    classes[c].reallocs++;
+	    classes[c].bytes += op->size;
+	    if (born[op->index] == 0) {     /* realloc of NULL */
+		born[op->index] = i + 1;
+		reallocs[op->index] = 0;
+	    } else {
+		live -= sizes[op->index];
+		reallocs[op->index]++;
+	    }
+	    sizes[op->index] = op->size;
+	    live += op->size;
+	    break;
+	case FREE:
+	    if (born[op->index] == 0)
+		break;
+	    classes[class_of(sizes[op->index])].frees++;
+	    lifetimes[class_of(i + 1 - born[op->index])]++;
+	    chains[class_of(reallocs[op->index])]++;
+	    live -= sizes[op->index];
+	    born[op->index] = 0;
+	    break;
+	}
+	if (live > peak) {
+	    peak = live;
+	    peak_op = i;
+	}
+	if (live > window_peak)
+	    window_peak = live;
+
+	/* One point of the series per points-th of the trace */
+	if (point < points && (i + 1 >= next_point || i + 1 == num_ops)) {
+	    last_op[point] = i;
+	    live_at[point] = live;
+	    peak_in[point] = window_peak;
+	    window_peak = live;
+	    point++;
+	    next_point = (point + 1) * num_ops / points;
+	    if (next_point <= i + 1)
+		next_point = i + 2;
+	}
+    }
+    for (i = 0; i < (uint64_t)trace->num_ids; i++)
+	unfreed += born[i] != 0;
+
+    /* Summary */
+    if (csv) {
+	printf("summary,trace,ops,ids,peak_bytes,peak_op,unfreed\n");
+	printf("summary,%s,%llu,%d,%llu,%llu,%llu\n", name,
+	       (unsigned long long)num_ops, trace->num_ids,
+	       (unsigned long long)peak, (unsigned long long)peak_op,
+	       (unsigned long long)unfreed);
+	printf("ops,type,count,share\n");
+    } else {
+	printf("%s: %llu ops on %d ids, peak of %llu live bytes at op %llu, "
+	       "%llu blocks never freed\n", name, (unsigned long long)num_ops,
+	       trace->num_ids, (unsigned long long)peak,
+	       (unsigned long long)peak_op, (unsigned long long)unfreed);
+	printf("\nOps\n");
+    }
+    for (i = 0; i <= MEMALIGN; i++)
+	if (csv)
+	    printf("ops,%s,%llu,%.4f\n", type_names[i],
+		   (unsigned long long)type_ops[i],
+		   num_ops ? (double)type_ops[i] / num_ops : 0);
+	else
+	    printf("%-10s %12llu %6.1f%%\n", type_names[i],
+		   (unsigned long long)type_ops[i],
+		   num_ops ? 100.0 * type_ops[i] / num_ops : 0);
+
+    /* Size classes */
+    if (csv)
+	printf("sizes,lo,hi,allocs,reallocs,frees,bytes,op_share\n");
+    else
+	printf("\nSize classes (bytes asked for)\n%21s %12s %12s %12s %14s %7s\n",
+	       "size", "allocs", "reallocs", "frees", "bytes", "ops");
+    for (c = 0; c < NUM_CLASSES; c++) {
+	class_t *k = &classes[c];
+	uint64_t ops = k->allocs + k->reallocs + k->frees;
+	unsigned long long lo = c == 0 ? 0 : (1ULL << (c - 1)) + 1;
+	unsigned long long hi = c == 64 ? ~0ULL : 1ULL << c;
+
+	if (ops == 0)
+	    continue;
+	if (csv)
+	    printf("sizes,%llu,%llu,%llu,%llu,%llu,%llu,%.4f\n", lo, hi,
+		   (unsigned long long)k->allocs, (unsigned long long)k->reallocs,
+		   (unsigned long long)k->frees, (unsigned long long)k->bytes,
+		   (double)ops / num_ops);
+	else
+	    printf("%10llu-%-10llu %12llu %12llu %12llu %14llu %6.1f%%\n", lo, hi,
+		   (unsigned long long)k->allocs, (unsigned long long)k->reallocs,
+		   (unsigned long long)k->frees, (unsigned long long)k->bytes,
+		   100.0 * ops / num_ops);
+    }
+
+    print_classes("lifetimes", "ops", lifetimes);
+    print_classes("chains", "reallocs", chains);
+
+    /* Live bytes over the trace */
+    if (csv)
+	printf("series,first_op,last_op,live_bytes,peak_bytes\n");
+    else
+	printf("\nLive payload bytes\n%12s %12s %12s %12s\n",
+	       "first op", "last op", "at last op", "peak");
+    for (ch = 0; ch < point; ch++)
+	printf(csv ? "series,%llu,%llu,%llu,%llu\n" : "%12llu %12llu %12llu %12llu\n",
+	       (unsigned long long)(ch > 0 ? last_op[ch - 1] + 1 : 0),
+	       (unsigned long long)last_op[ch], (unsigned long long)live_at[ch],
+	       (unsigned long long)peak_in[ch]);
+
+    free(sizes);
+    free(born);
+    free(reallocs);
+    free(last_op);
+    free(live_at);
+    free(peak_in);
+    free_trace(trace);
+    exit(0);
+}
+
+/*
+ * class_of - the power-of-two class of v: 0 for 0 and 1, else the k
+ *     with 2^(k-1) < v <= 2^k
+ */
+static int class_of(uint64_t v)
+{
+    return v <= 1 ? 0 : 64 - __builtin_clzll(v - 1);
+}
+
+/*
+ * print_classes - print a histogram of freed blocks per power-of-two
+ *     class of unit, as table
+ */
+static void print_classes(char *table, char *unit, uint64_t *counts)
+{
+    uint64_t total = 0;
+    int c;
+
+    for (c = 0; c < NUM_CLASSES; c++)
+	total += counts[c];
+
+    if (csv)
+	printf("%s,lo,hi,blocks,share\n", table);
+    else
+	printf("\nFreed blocks by %s (%s)\n%21s %12s %7s\n", table, unit, unit,
+	       "blocks", "share");
+    for (c = 0; c < NUM_CLASSES; c++) {
+	unsigned long long lo = c == 0 ? 0 : (1ULL << (c - 1)) + 1;
+	unsigned long long hi = c == 64 ? ~0ULL : 1ULL << c;
+
+	if (counts[c] == 0)
+	    continue;
+	if (csv)
+	    printf("%s,%llu,%llu,%llu,%.4f\n", table, lo, hi,
+		   (unsigned long long)counts[c], (double)counts[c] / total);
+	else
+	    printf("%10llu-%-10llu %12llu %6.1f%%\n", lo, hi,
+		   (unsigned long long)counts[c], 100.0 * counts[c] / total);
+    }
+}
+
+/*
+ * app_error - Report an arbitrary application error and exit
+ */
+static void app_error(char *msg)
+{
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+}